@@ -56,10 +56,95 @@
 #include <stdlib.h>
 #include <string.h>
 
+// ARENA_MMAP enables features that use mmap and related functions.
+// Define it to 0 to disable them.
+#if !defined(ARENA_MMAP) && (defined(__unix__) || defined(__APPLE__))
+#define ARENA_MMAP 1
+#endif
+
+#if ARENA_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef __cplusplus
+#include <new>
+#include <type_traits>
+#include <utility>
+#if __cplusplus >= 201703L
+#include <string_view>
+#endif
+#if __cplusplus > 201703L && __has_include(<span>)
+#include <span>
+#endif
+#endif
+
+// ARENA_PMR enables ArenaResource, which requires C++17's
+// <memory_resource>.  Define it to 0 to disable it.
+#if !defined(ARENA_PMR) && defined(__cplusplus) && __cplusplus >= 201703L
+#if __has_include(<memory_resource>)
+#define ARENA_PMR 1
+#endif
+#endif
+
+#if ARENA_PMR
+#include <memory_resource>
+#endif
+
 #ifndef ARENA_FIRST_BLOCK_SIZE
 #define ARENA_FIRST_BLOCK_SIZE 4096
 #endif
 
+#ifndef ARENA_ALIGNED_BLOCK_ALIGNMENT
+#define ARENA_ALIGNED_BLOCK_ALIGNMENT 4096
+#endif
+
+#ifndef ARENA_CALLOC_MIN_SIZE
+#define ARENA_CALLOC_MIN_SIZE ((size_t)128 << 10)
+#endif
+
+#ifndef ARENA_HUGE_PAGE_SIZE
+#define ARENA_HUGE_PAGE_SIZE ((size_t)2 << 20)
+#endif
+
+#ifndef ARENA_POOL_MAX_BLOCK_SIZE
+#define ARENA_POOL_MAX_BLOCK_SIZE ((size_t)16 << 20)
+#endif
+
+#ifndef ARENA_POOL_LOCAL_LIMIT
+#define ARENA_POOL_LOCAL_LIMIT 4
+#endif
+
+#ifndef ARENA_POOL_GLOBAL_LIMIT
+#define ARENA_POOL_GLOBAL_LIMIT 16
+#endif
+
+#ifndef ARENA_LARGE_ALLOCATION_SIZE
+#define ARENA_LARGE_ALLOCATION_SIZE ((size_t)64 << 10)
+#endif
+
+#ifndef ARENA_TAIL_COUNT
+#define ARENA_TAIL_COUNT 4
+#endif
+
+#ifndef ARENA_MIN_TAIL_SIZE
+#define ARENA_MIN_TAIL_SIZE 64
+#endif
+
+#ifndef ARENA_SCRATCH_COUNT
+#define ARENA_SCRATCH_COUNT 2
+#endif
+
+// Define ARENA_STATS to 1 to make each Arena keep statistics about its usage,
+// which you can get with arena_stats.
+#ifndef ARENA_STATS
+#define ARENA_STATS 0
+#endif
+
 #ifndef ARENA_SMALL_STRING_SIZE
 #define ARENA_SMALL_STRING_SIZE 16
 #endif
@@ -68,10 +153,37 @@
 #define ARENA_SMALL_LIST_SIZE 16
 #endif
 
+// The number of keys ahash_find_batch works on at a time.  Each key in a batch
+// can have a few cache misses in flight at the same time.
+#ifndef AHASH_FIND_BATCH_SIZE
+#define AHASH_FIND_BATCH_SIZE 16
+#endif
+
+// The number of slots of the old table that an AHash growing incrementally
+// moves to its new table each time an item is added.  This must be at least
+// 2 so the move finishes before the hash needs to grow again.
+#ifndef AHASH_MIGRATION_STEP
+#define AHASH_MIGRATION_STEP 32
+#endif
+
 #define MAGIC_ASTR  0xa3bff2a73e545341  // "AST>" + 4 non-ASCII bytes
 #define MAGIC_ALI   0xb4a888b43e494c41  // "ALI>" + 4 non-ASCII bytes
 #define MAGIC_AHASH 0x89cdfacf3e414841  // "AHA>" + 4 non-ASCII bytes
 
+#ifdef __cplusplus
+#define ARENA_THREAD_LOCAL thread_local
+#else
+#define ARENA_THREAD_LOCAL _Thread_local
+#endif
+
+// The core AHash functions take the key type and sizes as arguments and are
+// always inlined, so the ahash_fixed_* functions get code specialized for
+// their sizes even at -O2.  The generic AHash functions that call them with
+// sizes read at run time are never inlined, so a program only has one copy
+// of each.
+#define _ARENA_ALWAYS_INLINE inline __attribute__((always_inline))
+#define _ARENA_NOINLINE __attribute__((noinline, unused))
+
 #ifndef __cplusplus
 
 // T** (const not allowed on the T, T*) is changed to 'void**'
@@ -93,6 +205,24 @@
 
 typedef void (*ArenaNoMemoryCallback)(void *, size_t size);
 
+// Allocates a block of memory for an arena.  Returns NULL on failure.
+// Sets *zeroed to true if the memory is known to be zero, which allows the
+// arena to skip initializing it.  Setting *zeroed to true also promises that
+// the block is private anonymous memory, whose pages read as zero again after
+// they are discarded with madvise(MADV_DONTNEED) (see trim_on_clear).  Leave
+// it false for shared or file-backed memory, even if it is known to be zero.
+typedef void * (*ArenaBlockAllocCallback)(void *, size_t size, bool * zeroed);
+
+// Frees a block of memory that was returned by an ArenaBlockAllocCallback.
+typedef void (*ArenaBlockFreeCallback)(void *, void * block, size_t size);
+
+// Tries to grow a block returned by an ArenaBlockAllocCallback in place, from
+// old_size to new_size bytes, without moving it.  Returns true on success.
+// Sets *zeroed to true if the added memory is known to be zero (with the
+// same promise as for ArenaBlockAllocCallback).
+typedef bool (*ArenaBlockGrowCallback)(void *, void * block, size_t old_size,
+  size_t new_size, bool * zeroed);
+
 typedef struct ArenaBlockHeader
 {
   struct ArenaBlockHeader * prev;
@@ -105,6 +235,74 @@ typedef struct ArenaBlockHeader
 static const size_t arena_block_overhead = sizeof(ArenaBlockHeader) +
   (-sizeof(ArenaBlockHeader) % alignof(max_align_t));
 
+#if ARENA_STATS
+#define _ARENA_STAT(x) (x)
+#else
+#define _ARENA_STAT(x) ((void)0)
+#endif
+
+// Statistics kept by an Arena if ARENA_STATS is 1.
+typedef struct ArenaStats
+{
+  // Number of allocations made, and the total size requested by them
+  // (adjusted when allocations are resized).
+  size_t allocation_count;
+  size_t bytes_requested;
+
+  // Number of bytes skipped to align allocations.
+  size_t alignment_padding;
+
+  // Number of allocations made from the tails of previous blocks, and
+  // allocations that got their own block because they were large.
+  size_t tail_allocation_count;
+  size_t large_allocation_count;
+
+  // Number of successful calls to arena_resize.
+  size_t resize_count;
+
+  // Number of calls to arena_clear.
+  size_t clear_count;
+
+  // Number of blocks the arena currently has and their total size
+  // (the same as arena_memory_size).
+  size_t block_count;
+  size_t block_bytes;
+
+  // Total number of bytes left unused at the end of blocks when the arena
+  // started new blocks (some of this might later be used as tails).
+  size_t abandoned_bytes;
+} ArenaStats;
+
+// Hash functions that can be used by hash containers.
+typedef enum ArenaHashFunction : uint8_t {
+  // HalfSipHash-2-4, keyed with the arena's hash_key.  This is the default.
+  // It resists hash flooding attacks, so use it for keys that might come from
+  // an untrusted source.
+  ARENA_HASH_SIPHASH = 0,
+
+  // A much faster hash in the style of wyhash, which processes 16 bytes at a
+  // time, and uses a single multiplication for 4-byte and 8-byte keys.  It is
+  // seeded with hash_key but should only be used for trusted keys.
+  ARENA_HASH_FAST = 1,
+} ArenaHashFunction;
+
+// A cleanup callback registered with arena_defer.
+typedef void (*ArenaDeferCallback)(void * context);
+
+typedef struct ArenaDeferred
+{
+  struct ArenaDeferred * prev;
+  ArenaDeferCallback callback;
+  void * context;
+} ArenaDeferred;
+
+// The unused space at the end of a block the arena stopped allocating from.
+typedef struct ArenaTail
+{
+  uintptr_t start;
+  uintptr_t end;
+} ArenaTail;
+
 typedef struct Arena
 {
   ArenaBlockHeader * block;
@@ -118,6 +316,15 @@ typedef struct Arena
   // The end of the current block.
   uintptr_t block_end;
 
+  // The memory in the current block from block_dirty_end or block_remainder
+  // (whichever is higher) to block_end is known to be zero, so arena_alloc
+  // does not need to clear it.
+  uintptr_t block_dirty_end;
+
+  // The end of the virtual address range reserved by arena_init_virtual,
+  // or 0 if the arena is using normal malloc'd blocks.
+  uintptr_t reserve_end;
+
   // An estimate of the size a single block would need to be in order to
   // hold all the allocations currently assigned by calls to arena_alloc.
   // For efficiency, this does NOT include allocations in the current block
@@ -133,13 +340,66 @@ typedef struct Arena
   // The user can change this value at any time to manage the arena's memory
   // usage.  For example, you might reduce it by 10% periodically to make sure
   // the arena's memory usage does not permanently stay high due to a
-  // one-time event.
+  // one-time event, or you can set size_estimate_decay to do that
+  // automatically.
   size_t size_estimate_high;
 
+  // If this is nonzero, each call to arena_clear decays size_estimate_high
+  // by 1/2^size_estimate_decay of its value (but not below the amount of
+  // memory that was in use), so it acts like a maximum over the recent
+  // clear cycles instead of an all-time maximum.  For example, 3 makes it
+  // decay by 12.5% per cycle.  Values of at least the number of bits in a
+  // size_t also disable the decay.
+  uint8_t size_estimate_decay;
+
+  // If this is true, and size_estimate_high decays, arena_clear tells the
+  // operating system it can reclaim the pages of the retained block that
+  // are beyond what the arena anticipates it will need (using
+  // madvise(MADV_DONTNEED)).  If the block allocator reported the block as
+  // zeroed (which implies it is private anonymous memory), those pages will
+  // be zero when used again, so the arena does not need to clear them.
+  bool trim_on_clear;
+
+  // True if the block allocator reported the current block as zeroed, so
+  // pages of it discarded by trim_on_clear read as zero.
+  bool block_discard_zeroes;
+
+  // The largest tails of blocks that the arena stopped allocating from,
+  // which can be used for allocations that do not fit in the current block.
+  // Unused entries are zero.
+  ArenaTail tails[ARENA_TAIL_COUNT];
+
+  // The cleanup callbacks registered with arena_defer, newest first.  The
+  // list itself is stored in the arena's blocks.
+  ArenaDeferred * deferred;
+
   // Callback to use when malloc fails, before ending the program.
   ArenaNoMemoryCallback no_memory_callback;
   void * no_memory_callback_data;
 
+  // Callbacks used to allocate and free the arena's blocks, and the data
+  // passed to them as their first argument.  If these are NULL, the arena
+  // uses malloc and free.  This header provides a few implementations
+  // (e.g. arena_block_alloc_mmap) but you can also write your own.
+  // Only change these while the arena has no blocks.
+  ArenaBlockAllocCallback block_alloc_callback;
+  ArenaBlockFreeCallback block_free_callback;
+  void * block_callback_data;
+
+  // Optional callback that arena_resize and arena_realloc use to grow the
+  // current block in place when the last allocation does not fit in it.
+  // It gets block_callback_data too.  (Arenas made with arena_init_virtual
+  // always grow in place and do not need this.)
+  ArenaBlockGrowCallback block_grow_callback;
+
+#if ARENA_STATS
+  ArenaStats stats;
+#endif
+
+  // The hash function used by arena_hash, and the default for hash
+  // containers created from this arena (see ahash_set_hash_function).
+  ArenaHashFunction hash_function;
+
   // A random number used by hash containers.  You can initialize this
   // directly, or leave it at zero and the library will initialize it using
   // rand() the first time it is needed.
@@ -147,7 +407,8 @@ typedef struct Arena
 } Arena;
 
 // Returns the total amount of memory the Arena has allocated for from the
-// system using malloc.  This includes unused space in the blocks.
+// system using malloc (or its block allocator).  This includes unused space in
+// the blocks.
 static inline size_t arena_memory_size(const Arena * arena)
 {
   size_t size = 0;
@@ -160,6 +421,16 @@ static inline size_t arena_memory_size(const Arena * arena)
   return size;
 }
 
+#if ARENA_STATS
+
+// Returns the statistics the arena has collected.  This takes constant time.
+static inline ArenaStats arena_stats(const Arena * arena)
+{
+  return arena->stats;
+}
+
+#endif
+
 // Increases the given value until it has the given alignment.
 static inline size_t arena_align(size_t v, size_t alignment)
 {
@@ -183,6 +454,20 @@ static void arena_handle_no_memory(Arena * arena, size_t code)
   exit(1);
 }
 
+// private function: Returns header_size + count * item_size, handling the
+// case where that would not fit in a size_t as an out-of-memory error.
+static inline size_t arena_array_size(Arena * arena, size_t header_size,
+  size_t count, size_t item_size)
+{
+  size_t size;
+  if (__builtin_mul_overflow(count, item_size, &size) ||
+    __builtin_add_overflow(size, header_size, &size))
+  {
+    arena_handle_no_memory(arena, SIZE_MAX);
+  }
+  return size;
+}
+
 // private function
 static void arena_done_with_block(Arena * arena)
 {
@@ -206,26 +491,504 @@ static void arena_done_with_block(Arena * arena)
   }
 }
 
+//// Block allocators //////////////////////////////////////////////////////////
+// These functions can be used as the block_alloc_callback and
+// block_free_callback of an Arena.  Unless otherwise noted, they ignore their
+// data argument.
+
+// Allocates blocks with malloc (the default).  Blocks of at least
+// ARENA_CALLOC_MIN_SIZE bytes are allocated with calloc instead, since
+// large allocations usually come fresh from the operating system, so calloc
+// can return them without clearing them, and then the arena does not need
+// to clear them either.
+static inline void * arena_block_alloc_malloc(void * data, size_t size, bool * zeroed)
+{
+  (void)data;
+  if (size >= ARENA_CALLOC_MIN_SIZE)
+  {
+    *zeroed = true;
+    return calloc(1, size);
+  }
+  *zeroed = false;
+  return malloc(size);
+}
+
+// Frees blocks allocated with arena_block_alloc_malloc or
+// arena_block_alloc_aligned.
+static inline void arena_block_free_malloc(void * data, void * block, size_t size)
+{
+  (void)data; (void)size;
+  free(block);
+}
+
+// Allocates blocks with aligned_alloc, aligning them to
+// ARENA_ALIGNED_BLOCK_ALIGNMENT (4096 by default).  Use
+// arena_block_free_malloc to free them.
+static inline void * arena_block_alloc_aligned(void * data, size_t size, bool * zeroed)
+{
+  (void)data;
+  *zeroed = false;
+  size_t aligned_size = arena_align(size, ARENA_ALIGNED_BLOCK_ALIGNMENT);
+  if (aligned_size < size) { return NULL; }
+  return aligned_alloc(ARENA_ALIGNED_BLOCK_ALIGNMENT, aligned_size);
+}
+
+#if ARENA_MMAP
+
+// Allocates blocks directly from the operating system with mmap.
+static inline void * arena_block_alloc_mmap(void * data, size_t size, bool * zeroed)
+{
+  (void)data;
+  *zeroed = true;
+  void * block = mmap(NULL, size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return block == MAP_FAILED ? NULL : block;
+}
+
+// Frees blocks allocated with arena_block_alloc_mmap.
+static inline void arena_block_free_mmap(void * data, void * block, size_t size)
+{
+  (void)data;
+  munmap(block, size);
+}
+
+// Options for arena_block_alloc_huge.  The data pointer of the arena's block
+// callbacks can point to one of these, or be NULL to use the defaults.
+typedef struct ArenaHugePageOptions
+{
+  // Blocks at least this large are backed by huge pages.  Smaller blocks are
+  // allocated with malloc.  0 means ARENA_HUGE_PAGE_SIZE.
+  size_t threshold;
+
+  // If true, try to use MAP_HUGETLB first.  That only works if the system
+  // has reserved huge pages, so transparent huge pages are used as a
+  // fallback.
+  bool use_hugetlb;
+} ArenaHugePageOptions;
+
+// private function
+static inline size_t arena_huge_page_threshold(const void * data)
+{
+  const ArenaHugePageOptions * options = (const ArenaHugePageOptions *)data;
+  if (options == NULL || options->threshold == 0) { return ARENA_HUGE_PAGE_SIZE; }
+  return options->threshold;
+}
+
+// Allocates large blocks aligned to ARENA_HUGE_PAGE_SIZE (2 MiB by default)
+// and backed by huge pages if possible, to reduce TLB misses when accessing
+// large data structures.  Uses transparent huge pages (MADV_HUGEPAGE) or
+// MAP_HUGETLB, depending on the options.  If huge pages are not available,
+// the block is still allocated, but with normal pages.
+// The data argument is an optional pointer to ArenaHugePageOptions.
+// Use arena_block_free_huge to free the blocks.
+static inline void * arena_block_alloc_huge(void * data, size_t size, bool * zeroed)
+{
+  if (size < arena_huge_page_threshold(data))
+  {
+    return arena_block_alloc_malloc(data, size, zeroed);
+  }
+  *zeroed = true;
+
+  size_t aligned_size = arena_align(size, ARENA_HUGE_PAGE_SIZE);
+  if (aligned_size < size) { return NULL; }
+
+#ifdef MAP_HUGETLB
+  const ArenaHugePageOptions * options = (const ArenaHugePageOptions *)data;
+  if (options && options->use_hugetlb)
+  {
+    void * block = mmap(NULL, aligned_size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (block != MAP_FAILED) { return block; }
+  }
+#endif
+
+  // Map more than we need so we can trim it to a properly aligned range.
+  size_t map_size = aligned_size + ARENA_HUGE_PAGE_SIZE;
+  if (map_size < aligned_size) { return NULL; }
+  void * map = mmap(NULL, map_size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (map == MAP_FAILED) { return NULL; }
+  uintptr_t start = arena_align((uintptr_t)map, ARENA_HUGE_PAGE_SIZE);
+  uintptr_t end = start + aligned_size;
+  if (start != (uintptr_t)map) { munmap(map, start - (uintptr_t)map); }
+  if (end != (uintptr_t)map + map_size)
+  {
+    munmap((void *)end, (uintptr_t)map + map_size - end);
+  }
+#ifdef MADV_HUGEPAGE
+  madvise((void *)start, aligned_size, MADV_HUGEPAGE);
+#endif
+  return (void *)start;
+}
+
+// Frees blocks allocated with arena_block_alloc_huge.  The data argument must
+// be the same as the one used to allocate them.
+static inline void arena_block_free_huge(void * data, void * block, size_t size)
+{
+  if (size < arena_huge_page_threshold(data))
+  {
+    free(block);
+  }
+  else
+  {
+    munmap(block, arena_align(size, ARENA_HUGE_PAGE_SIZE));
+  }
+}
+
+#endif
+
+// The block pool is a cache of freed blocks that can be reused by any arena
+// using arena_block_alloc_pooled, which is useful if you create and destroy
+// many short-lived arenas.  Blocks are grouped by size (only sizes that are
+// powers of 2, up to ARENA_POOL_MAX_BLOCK_SIZE, are cached).  Each thread
+// has its own cache holding up to ARENA_POOL_LOCAL_LIMIT blocks of each
+// size, which needs no locking, and there is a process-wide cache holding up
+// to ARENA_POOL_GLOBAL_LIMIT blocks of each size, protected by a spinlock.
+//
+// Since all the functions and variables in this header are static, each
+// translation unit that includes it has its own pool.  Blocks cached by a
+// thread are leaked when the thread exits unless it calls
+// arena_block_pool_trim first.
+typedef struct ArenaBlockPool
+{
+  ArenaBlockHeader * blocks[sizeof(size_t) * 8];  // linked by their prev field
+  uint32_t counts[sizeof(size_t) * 8];
+} ArenaBlockPool;
+
+static ARENA_THREAD_LOCAL ArenaBlockPool arena_block_pool_local;
+static ArenaBlockPool arena_block_pool_global;
+static bool arena_block_pool_global_lock;
+
+// private function: Returns the index of the size class for blocks of the
+// specified size, or -1 if blocks of that size are not pooled.
+static inline int arena_block_pool_class(size_t size)
+{
+  if (size > ARENA_POOL_MAX_BLOCK_SIZE || (size & (size - 1))) { return -1; }
+  int c = 0;
+  while (size >>= 1) { c++; }
+  return c;
+}
+
+// private function
+static inline ArenaBlockHeader * arena_block_pool_pop(ArenaBlockPool * pool, int c)
+{
+  ArenaBlockHeader * block = pool->blocks[c];
+  if (block)
+  {
+    pool->blocks[c] = block->prev;
+    pool->counts[c]--;
+  }
+  return block;
+}
+
+// private function
+static inline bool arena_block_pool_push(ArenaBlockPool * pool, int c,
+  ArenaBlockHeader * block, uint32_t limit)
+{
+  if (pool->counts[c] >= limit) { return false; }
+  block->prev = pool->blocks[c];
+  pool->blocks[c] = block;
+  pool->counts[c]++;
+  return true;
+}
+
+// private function
+static inline void arena_block_pool_lock()
+{
+  while (__atomic_test_and_set(&arena_block_pool_global_lock, __ATOMIC_ACQUIRE)) { }
+}
+
+// private function
+static inline void arena_block_pool_unlock()
+{
+  __atomic_clear(&arena_block_pool_global_lock, __ATOMIC_RELEASE);
+}
+
+// Allocates blocks from the block pool if possible, or with malloc otherwise.
+// Use arena_block_free_pooled to free them.
+static inline void * arena_block_alloc_pooled(void * data, size_t size, bool * zeroed)
+{
+  int c = arena_block_pool_class(size);
+  if (c >= 0)
+  {
+    *zeroed = false;
+    ArenaBlockHeader * block = arena_block_pool_pop(&arena_block_pool_local, c);
+    if (block) { return block; }
+    arena_block_pool_lock();
+    block = arena_block_pool_pop(&arena_block_pool_global, c);
+    arena_block_pool_unlock();
+    if (block) { return block; }
+  }
+  return arena_block_alloc_malloc(data, size, zeroed);
+}
+
+// Returns a block to the block pool, or frees it if the pool is full.
+static inline void arena_block_free_pooled(void * data, void * block, size_t size)
+{
+  (void)data;
+  int c = arena_block_pool_class(size);
+  if (c >= 0)
+  {
+    ArenaBlockHeader * header = (ArenaBlockHeader *)block;
+    if (arena_block_pool_push(&arena_block_pool_local, c, header,
+      ARENA_POOL_LOCAL_LIMIT))
+    {
+      return;
+    }
+    arena_block_pool_lock();
+    bool pushed = arena_block_pool_push(&arena_block_pool_global, c, header,
+      ARENA_POOL_GLOBAL_LIMIT);
+    arena_block_pool_unlock();
+    if (pushed) { return; }
+  }
+  free(block);
+}
+
+// Frees all the blocks in the calling thread's cache and the process-wide
+// cache of the block pool.
+static inline void arena_block_pool_trim()
+{
+  for (size_t c = 0; c < sizeof(size_t) * 8; c++)
+  {
+    ArenaBlockHeader * block;
+    while ((block = arena_block_pool_pop(&arena_block_pool_local, c)))
+    {
+      free(block);
+    }
+    arena_block_pool_lock();
+    while ((block = arena_block_pool_pop(&arena_block_pool_global, c)))
+    {
+      free(block);
+    }
+    arena_block_pool_unlock();
+  }
+}
+
+// private function
+static ArenaBlockHeader * arena_alloc_block(Arena * arena, size_t block_size,
+  bool * zeroed)
+{
+  void * block;
+  *zeroed = false;
+  if (arena->block_alloc_callback)
+  {
+    block = arena->block_alloc_callback(arena->block_callback_data,
+      block_size, zeroed);
+  }
+  else
+  {
+    block = arena_block_alloc_malloc(NULL, block_size, zeroed);
+  }
+  if (block == NULL) { arena_handle_no_memory(arena, block_size); }
+  _ARENA_STAT(arena->stats.block_count++);
+  _ARENA_STAT(arena->stats.block_bytes += block_size);
+  return (ArenaBlockHeader *)block;
+}
+
+// private function
+static void arena_free_block(Arena * arena, ArenaBlockHeader * block)
+{
+  _ARENA_STAT(arena->stats.block_count--);
+  _ARENA_STAT(arena->stats.block_bytes -= block->size);
+  if (arena->block_free_callback)
+  {
+    arena->block_free_callback(arena->block_callback_data, block, block->size);
+  }
+  else
+  {
+    free(block);
+  }
+}
+
+// private function: Remembers the unused space at the end of the current
+// block, if it is large enough, replacing the smallest remembered tail.
+static void arena_remember_tail(Arena * arena)
+{
+  if (arena->block == NULL) { return; }
+  if (arena->block_remainder > arena->block_end) { return; }
+  size_t size = arena->block_end - arena->block_remainder;
+  if (size < ARENA_MIN_TAIL_SIZE) { return; }
+
+  ArenaTail * smallest = &arena->tails[0];
+  for (size_t i = 1; i < ARENA_TAIL_COUNT; i++)
+  {
+    ArenaTail * tail = &arena->tails[i];
+    if (tail->end - tail->start < smallest->end - smallest->start)
+    {
+      smallest = tail;
+    }
+  }
+  if (size > smallest->end - smallest->start)
+  {
+    smallest->start = arena->block_remainder;
+    smallest->end = arena->block_end;
+  }
+}
+
+// private function: Tries to make an allocation from one of the remembered
+// tails.  Returns NULL if none of them are big enough.
+static void * arena_alloc_from_tail(Arena * arena, size_t size, size_t alignment)
+{
+  for (size_t i = 0; i < ARENA_TAIL_COUNT; i++)
+  {
+    ArenaTail * tail = &arena->tails[i];
+    if (tail->start == 0) { continue; }
+    uintptr_t a = arena_align(tail->start, alignment);
+    if (a > tail->end || tail->end - a < size) { continue; }
+
+    // The tail's block was already counted, up to the start of the tail.
+    arena->size_estimate += a + size - tail->start;
+    _ARENA_STAT(arena->stats.allocation_count++);
+    _ARENA_STAT(arena->stats.bytes_requested += size);
+    _ARENA_STAT(arena->stats.alignment_padding += a - tail->start);
+    _ARENA_STAT(arena->stats.tail_allocation_count++);
+
+    tail->start = a + size;
+    if (tail->end - tail->start < ARENA_MIN_TAIL_SIZE)
+    {
+      tail->start = tail->end = 0;
+    }
+    return (void *)a;
+  }
+  return NULL;
+}
+
+// private function
+static inline void arena_forget_tails(Arena * arena)
+{
+  memset(arena->tails, 0, sizeof(arena->tails));
+}
+
 // Allocates a new block with the specified number of bytes available for
 // payload data (and stop allocating from the current block).  This function
 // should probably not be used in most applications but it could be useful for
 // testing of low-level code.
 static void arena_start_new_block(Arena * arena, size_t payload_size)
 {
+  assert(arena->reserve_end == 0);  // not supported for virtual arenas
+
   arena_done_with_block(arena);
+  arena_remember_tail(arena);
+  if (arena->block && arena->block_remainder <= arena->block_end)
+  {
+    _ARENA_STAT(arena->stats.abandoned_bytes +=
+      arena->block_end - arena->block_remainder);
+  }
 
   size_t block_size = arena_block_overhead + payload_size;
 
-  ArenaBlockHeader * new_block = (ArenaBlockHeader *)malloc(block_size);
-  if (new_block == NULL) { arena_handle_no_memory(arena, block_size); }
+  bool zeroed;
+  ArenaBlockHeader * new_block = arena_alloc_block(arena, block_size, &zeroed);
 
   *new_block = (ArenaBlockHeader){ arena->block, block_size };
   arena->block = new_block;
   arena->block_last_allocation = 0;
   arena->block_remainder = (uintptr_t)arena->block + arena_block_overhead;
   arena->block_end = (uintptr_t)arena->block + arena->block->size;
+  arena->block_dirty_end = zeroed ? arena->block_remainder : arena->block_end;
+  arena->block_discard_zeroes = zeroed;
+}
+
+// private function: Records that the memory before block_remainder might not
+// be zero.  This must be called before block_remainder decreases.
+static inline void arena_mark_dirty(Arena * arena)
+{
+  if (arena->block_dirty_end < arena->block_remainder)
+  {
+    arena->block_dirty_end = arena->block_remainder;
+  }
 }
 
+// private function: Returns the number of bytes at the beginning of an
+// allocation that might not be zero, assuming nothing has been written to it
+// since it was allocated.
+static inline size_t arena_dirty_size(const Arena * arena,
+  const void * allocation, size_t size)
+{
+  uintptr_t a = (uintptr_t)allocation;
+  if (a < (uintptr_t)arena->block || a >= arena->block_end)
+  {
+    return size;  // not in the current block
+  }
+  if (arena->block_dirty_end <= a) { return 0; }
+  size_t dirty_size = arena->block_dirty_end - a;
+  return dirty_size < size ? dirty_size : size;
+}
+
+// private function: Commits more pages of a virtual arena's reservation so
+// that the current block ends at 'end' or later.  Like the block sizes of
+// a normal arena, the committed size at least doubles each time.
+static void arena_virtual_commit(Arena * arena, uintptr_t end)
+{
+#if ARENA_MMAP
+  assert(arena->reserve_end && end <= arena->reserve_end);
+  uintptr_t start = (uintptr_t)arena->block;
+  size_t size = arena->block_end - start;
+  size_t new_size = size * 2;
+  if (new_size < ARENA_FIRST_BLOCK_SIZE) { new_size = ARENA_FIRST_BLOCK_SIZE; }
+  if (new_size < end - start) { new_size = end - start; }
+  if (new_size > arena->reserve_end - start) { new_size = arena->reserve_end - start; }
+  new_size = arena_align(new_size, sysconf(_SC_PAGESIZE));
+  if (mprotect((void *)arena->block_end, start + new_size - arena->block_end,
+    PROT_READ | PROT_WRITE))
+  {
+    arena_handle_no_memory(arena, new_size);
+  }
+  _ARENA_STAT(arena->stats.block_bytes += start + new_size - arena->block_end);
+  arena->block_end = start + new_size;
+  if (size) { arena->block->size = new_size; }
+#else
+  (void)end;
+  arena_handle_no_memory(arena, 0xF0F0F006);
+#endif
+}
+
+#if ARENA_MMAP
+
+// Makes the arena reserve a contiguous range of virtual memory with the
+// specified size.  Instead of allocating a chain of blocks, the arena will
+// treat the reserved range as one big block and commit pages at the end of
+// it as they are needed.  This means that arena_resize always succeeds on the
+// last allocation (as long as the reservation is big enough), so ALists and
+// AStrings allocated last can grow in place without being copied.
+//
+// The reservation does not use any physical memory until it is committed,
+// so it can be much larger than you expect to need (e.g. several GB on a
+// 64-bit system).  Allocations that do not fit in the reservation are
+// treated as out-of-memory errors.
+//
+// This must be called on a zero-initialized arena (or one that was freed with
+// arena_free) before allocating anything from it.  arena_free releases
+// the reservation and turns the arena back into a normal arena.
+static inline void arena_init_virtual(Arena * arena, size_t reserve_size)
+{
+  assert(arena->block == NULL);
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  reserve_size = arena_align(reserve_size, page_size);
+  if (reserve_size < page_size) { reserve_size = page_size; }
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_NORESERVE
+  flags |= MAP_NORESERVE;
+#endif
+  void * range = mmap(NULL, reserve_size, PROT_NONE, flags, -1, 0);
+  if (range == MAP_FAILED) { arena_handle_no_memory(arena, reserve_size); }
+
+  // Nothing is committed yet, so the header is not valid until
+  // arena_virtual_commit is called.
+  arena->block = (ArenaBlockHeader *)range;
+  arena->block_end = (uintptr_t)range;
+  arena->reserve_end = (uintptr_t)range + reserve_size;
+  arena_virtual_commit(arena, (uintptr_t)range + arena_block_overhead);
+  *arena->block = (ArenaBlockHeader){ NULL, arena->block_end - (uintptr_t)range };
+  _ARENA_STAT(arena->stats.block_count = 1);
+  arena->block_last_allocation = 0;
+  arena->block_remainder = (uintptr_t)range + arena_block_overhead;
+  arena->block_dirty_end = arena->block_remainder;  // new pages are zero
+  arena->block_discard_zeroes = true;
+}
+
+#endif
+
 // Ensures the arena has enough space available in its current block to handle
 // an allocation of the given size and alignment.  Also returns the maximum
 // allocation size it could handle with the given alignment.
@@ -239,6 +1002,17 @@ static size_t arena_pre_alloc(Arena * arena, size_t size, size_t alignment)
     return arena->block_end - abr;
   }
 
+  if (arena->reserve_end)
+  {
+    // Virtual arenas just commit more of their reserved range.
+    if (abr > arena->reserve_end || arena->reserve_end - abr < size)
+    {
+      arena_handle_no_memory(arena, size);
+    }
+    arena_virtual_commit(arena, abr + size);
+    return arena->block_end - abr;
+  }
+
   // Figure out the minimum block size we would need to allocate.
   size_t min_block_size = arena_align(arena_block_overhead, alignment) + size;
 
@@ -277,33 +1051,124 @@ static size_t arena_pre_alloc(Arena * arena, size_t size, size_t alignment)
   return arena->block_end - abr;
 }
 
-// This is just like arena_alloc() except the memory is not initialized to
-// zero, so it is less safe.
-static void * arena_alloc_no_init(Arena * arena, size_t size, size_t alignment)
+// private function: Returns true if an allocation that does not fit in the
+// current block should get its own block.
+static inline bool arena_is_large_allocation(const Arena * arena, size_t size)
+{
+  return size >= ARENA_LARGE_ALLOCATION_SIZE && arena->block && !arena->reserve_end;
+}
+
+// private function: Allocates a block just large enough to hold a single
+// allocation and inserts it into the block list behind the current block,
+// so the arena can keep allocating from the current block.
+// If zero is true, the allocation is initialized to zero.
+static void * arena_alloc_large(Arena * arena, size_t size, size_t alignment,
+  bool zero)
+{
+  size_t padding = alignment > alignof(max_align_t) ? alignment - 1 : 0;
+  size_t block_size = arena_block_overhead + padding + size;
+  if (block_size < size) { arena_handle_no_memory(arena, SIZE_MAX); }
+
+  bool zeroed;
+  ArenaBlockHeader * block = arena_alloc_block(arena, block_size, &zeroed);
+  *block = (ArenaBlockHeader){ arena->block->prev, block_size };
+  arena->block->prev = block;
+
+  if (arena->size_estimate == 0)
+  {
+    arena->size_estimate = arena_block_overhead;
+  }
+  arena->size_estimate =
+    arena_align(arena->size_estimate, alignof(max_align_t)) + size;
+
+  _ARENA_STAT(arena->stats.allocation_count++);
+  _ARENA_STAT(arena->stats.bytes_requested += size);
+  _ARENA_STAT(arena->stats.large_allocation_count++);
+  uintptr_t start = (uintptr_t)block + arena_block_overhead;
+  void * allocation = (void *)arena_align(start, alignment);
+  _ARENA_STAT(arena->stats.alignment_padding += (uintptr_t)allocation - start);
+  if (zero && !zeroed) { memset(allocation, 0, size); }
+  return allocation;
+}
+
+// This is just like arena_alloc() except the memory is not initialized to
+// zero, so it is less safe.
+//
+// Allocations of ARENA_LARGE_ALLOCATION_SIZE bytes or more that do not fit in
+// the current block get a block of their own, instead of making the arena
+// abandon the rest of the current block.  Other allocations that do not fit
+// in the current block are made from the tails of previous blocks if
+// possible.  Since such allocations are not in the current block,
+// arena_resize cannot resize them.
+static void * arena_alloc_no_init(Arena * arena, size_t size, size_t alignment)
 {
   size_t abr = arena_align(arena->block_remainder, alignment);
   if (abr > arena->block_end || arena->block_end - abr < size)
   {
+    if (arena_is_large_allocation(arena, size))
+    {
+      return arena_alloc_large(arena, size, alignment, false);
+    }
+    void * allocation = arena_alloc_from_tail(arena, size, alignment);
+    if (allocation) { return allocation; }
     arena_pre_alloc(arena, size, alignment);
     abr = arena_align(arena->block_remainder, alignment);
   }
+  _ARENA_STAT(arena->stats.allocation_count++);
+  _ARENA_STAT(arena->stats.bytes_requested += size);
+  _ARENA_STAT(arena->stats.alignment_padding += abr - arena->block_remainder);
   arena->block_last_allocation = abr;
   arena->block_remainder = abr + size;
   return (void *)abr;
 }
 
 // Allocates memory from the arena with the specified size and alignment.
-// The memory is initialized to zero.
+// The memory is initialized to zero.  This skips clearing memory that is
+// known to be zero already because it came from a fresh block (see
+// ArenaBlockAllocCallback) and was never allocated before.
 //
 // Note: If size is 0, this function could return a NULL pointer or a pointer
 // equal to a previous allocation of size 0.
 static inline void * arena_alloc(Arena * arena, size_t size, size_t alignment)
 {
+  size_t abr = arena_align(arena->block_remainder, alignment);
+  if ((abr > arena->block_end || arena->block_end - abr < size) &&
+    arena_is_large_allocation(arena, size))
+  {
+    return arena_alloc_large(arena, size, alignment, true);
+  }
   void * allocation = arena_alloc_no_init(arena, size, alignment);
-  memset(allocation, 0, size);
+  memset(allocation, 0, arena_dirty_size(arena, allocation, size));
   return allocation;
 }
 
+// private function: Uses the block_grow_callback to grow the current block
+// in place so that it has room for 'size' bytes at the specified offset.
+// Like new blocks, the block at least doubles in size.
+static bool arena_grow_block(Arena * arena, size_t offset, size_t size)
+{
+  if (size > SIZE_MAX - offset) { return false; }
+  size_t min_size = offset + size;
+  size_t old_size = arena->block->size;
+  size_t new_size = old_size;
+  while (new_size < min_size)
+  {
+    if (new_size > SIZE_MAX / 2) { return false; }
+    new_size *= 2;
+  }
+  bool zeroed = false;
+  if (!arena->block_grow_callback(arena->block_callback_data, arena->block,
+    old_size, new_size, &zeroed))
+  {
+    return false;
+  }
+  _ARENA_STAT(arena->stats.block_bytes += new_size - old_size);
+  arena->block->size = new_size;
+  arena->block_end = (uintptr_t)arena->block + new_size;
+  if (!zeroed) { arena->block_dirty_end = arena->block_end; }
+  return true;
+}
+
 // Attempts to resize a memory region that was previously allocated with
 // arena_alloc, without moving it.  Returns true if successful.  It is OK to
 // pass *any* pointer as the second argument to this function, but this function
@@ -312,54 +1177,522 @@ static inline void * arena_alloc(Arena * arena, size_t size, size_t alignment)
 //
 // This does NOT zero-initialize any part of the allocated memory.
 //
+// For arenas using arena_init_virtual, growing the last allocation always
+// succeeds unless it would exceed the reservation.  For other arenas, if
+// block_grow_callback is set, it is used to try to grow the current block.
+//
 // Note: If you are trying to shrink a memory region and this function returns
 // false, you are strongly encouraged to use the new smaller capacity anyway, to
 // make the behavior of your program more predictable, and not so dependent on
 // the order that arena operations were performed.
 static bool arena_resize(Arena * arena, void * allocation, size_t new_size)
 {
-  if (arena->block == NULL) { return false; }
+  if (arena->block == NULL || allocation == NULL) { return false; }
   uintptr_t a = (uintptr_t)allocation;
   if (a != arena->block_last_allocation) { return false; }
   assert(a <= arena->block_remainder);
   assert(a <= arena->block_end);
-  if (arena->block_end - a < new_size) { return false; }
+  if (arena->block_end - a < new_size)
+  {
+    if (arena->reserve_end)
+    {
+      if (arena->reserve_end - a < new_size) { return false; }
+      arena_virtual_commit(arena, a + new_size);
+    }
+    else if (arena->block_grow_callback == NULL ||
+      !arena_grow_block(arena, a - (uintptr_t)arena->block, new_size))
+    {
+      return false;
+    }
+  }
+  _ARENA_STAT(arena->stats.resize_count++);
+  _ARENA_STAT(arena->stats.bytes_requested += a + new_size - arena->block_remainder);
+  arena_mark_dirty(arena);
   arena->block_remainder = a + new_size;
   return true;
 }
 
+// Changes the size of an allocation of old_size bytes that was made from the
+// arena, and returns a pointer to it.  If arena_resize can resize it in
+// place, that pointer is the same as the one passed in.  Otherwise, if the
+// allocation is growing, this makes a new allocation with the specified
+// alignment and copies the old contents into it, and the old memory just
+// stays in the arena unused.  Like arena_resize, this does NOT initialize
+// the added memory.  The allocation pointer can be NULL (with old_size 0).
+static void * arena_realloc(Arena * arena, void * allocation, size_t old_size,
+  size_t new_size, size_t alignment)
+{
+  if (arena_resize(arena, allocation, new_size)) { return allocation; }
+  if (new_size <= old_size) { return allocation; }
+  void * new_allocation = arena_alloc_no_init(arena, new_size, alignment);
+  if (old_size) { memcpy(new_allocation, allocation, old_size); }
+  return new_allocation;
+}
+
 // private function
-static void arena_free_block_list(ArenaBlockHeader * block)
+static void arena_free_block_list(Arena * arena, ArenaBlockHeader * block)
 {
   while (block)
   {
     ArenaBlockHeader * prev = block->prev;
-    free(block);
+    arena_free_block(arena, block);
     block = prev;
   }
 }
 
+// private function: Gives the pages at the end of the current block that the
+// arena does not anticipate needing back to the operating system.
+// Only call this when the block is empty.
+static inline void arena_trim_block(Arena * arena)
+{
+#if ARENA_MMAP
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t keep = arena_block_overhead + arena->size_estimate_high +
+    (arena->size_estimate_high >> 2);
+  if (keep >= arena->block->size) { return; }
+  uintptr_t start = arena_align((uintptr_t)arena->block + keep, page_size);
+  uintptr_t end = arena->block_end & ~(uintptr_t)(page_size - 1);
+  if (start < end && madvise((void *)start, end - start, MADV_DONTNEED) == 0 &&
+    arena->block_discard_zeroes && end == arena->block_end &&
+    arena->block_dirty_end > start)
+  {
+    // The discarded pages read as zero, since the block is private anonymous
+    // memory.  (Discarded pages of a shared or file-backed mapping would
+    // read back their old contents.)
+    arena->block_dirty_end = start;
+  }
+#else
+  (void)arena;
+#endif
+}
+
+// Registers a callback that will be called with the specified context
+// pointer when the arena is cleared or freed, or rewound to a mark created
+// before this call.  Callbacks are called in the reverse of the order they
+// were registered, before any memory is released, so the context can point
+// to memory in the arena.  This lets arena allocations own other resources,
+// like file descriptors, memory maps, or C++ objects (see arena_new).
+// Callbacks must not allocate from the arena.
+static inline void arena_defer(Arena * arena, ArenaDeferCallback callback,
+  void * context)
+{
+  ArenaDeferred * deferred = (ArenaDeferred *)arena_alloc_no_init(arena,
+    sizeof(ArenaDeferred), alignof(ArenaDeferred));
+  deferred->prev = arena->deferred;
+  deferred->callback = callback;
+  deferred->context = context;
+  arena->deferred = deferred;
+}
+
+// private function: Calls the deferred callbacks registered after 'stop'.
+static inline void arena_run_deferred(Arena * arena, ArenaDeferred * stop)
+{
+  while (arena->deferred != stop)
+  {
+    assert(arena->deferred);
+    ArenaDeferred * deferred = arena->deferred;
+    arena->deferred = deferred->prev;
+    deferred->callback(deferred->context);
+  }
+}
+
 // Free all blocks except the latest one, which the Arena will reuse.
 static inline void arena_clear(Arena * arena)
 {
+  _ARENA_STAT(arena->stats.clear_count++);
+  arena_run_deferred(arena, NULL);
   if (arena->block)
   {
     arena_done_with_block(arena);
-    arena_free_block_list(arena->block->prev);
+    arena_free_block_list(arena, arena->block->prev);
+    arena_forget_tails(arena);
     arena->block->prev = NULL;
     arena->block_last_allocation = 0;
+    arena_mark_dirty(arena);
     arena->block_remainder = (uintptr_t)arena->block + arena_block_overhead;
     assert(arena->block_end == (uintptr_t)arena->block + arena->block->size);
+
+    if (arena->size_estimate_decay &&
+      arena->size_estimate_decay < sizeof(size_t) * 8)
+    {
+      size_t high = arena->size_estimate_high;
+      size_t decayed = high - (high >> arena->size_estimate_decay);
+      if (decayed < arena->size_estimate) { decayed = arena->size_estimate; }
+      if (decayed < high)
+      {
+        arena->size_estimate_high = decayed;
+        if (arena->trim_on_clear) { arena_trim_block(arena); }
+      }
+    }
+    arena->size_estimate = 0;
   }
 }
 
 // Frees all the arena's blocks.
 static inline void arena_free(Arena * arena)
 {
+  arena_run_deferred(arena, NULL);
   arena_done_with_block(arena);
-  arena_free_block_list(arena->block);
+#if ARENA_MMAP
+  if (arena->reserve_end)
+  {
+    munmap(arena->block, arena->reserve_end - (uintptr_t)arena->block);
+    arena->reserve_end = 0;
+    _ARENA_STAT(arena->stats.block_count = 0);
+    _ARENA_STAT(arena->stats.block_bytes = 0);
+  }
+  else
+#endif
+  {
+    arena_free_block_list(arena, arena->block);
+  }
   arena->block = NULL;
   arena->block_last_allocation = arena->block_remainder = arena->block_end = 0;
+  arena->block_dirty_end = 0;
+  arena->block_discard_zeroes = false;
+  arena->size_estimate = 0;
+  arena_forget_tails(arena);
+}
+
+// An ArenaMark records a position in an arena so that you can later free
+// everything allocated after it with arena_rewind.
+typedef struct ArenaMark
+{
+  ArenaBlockHeader * block;
+  ArenaBlockHeader * block_prev;
+  uintptr_t remainder;
+  size_t size_estimate;
+  ArenaDeferred * deferred;
+} ArenaMark;
+
+// Returns a mark representing the current position of the arena.
+static inline ArenaMark arena_mark(const Arena * arena)
+{
+  ArenaMark mark = { arena->block, arena->block ? arena->block->prev : NULL,
+    arena->block_remainder, arena->size_estimate, arena->deferred };
+  return mark;
+}
+
+// Frees all the allocations made from the arena since the specified mark was
+// created, freeing any blocks that were started after it.  Marks must be used
+// like a stack: after rewinding to a mark, any marks created after it are
+// invalid.  If the mark was created when the arena had no blocks, this is
+// equivalent to arena_clear, so the latest block is retained.  Callbacks
+// registered with arena_defer since the mark was created are called.
+static inline void arena_rewind(Arena * arena, ArenaMark mark)
+{
+  arena_run_deferred(arena, mark.deferred);
+  if (mark.block == NULL)
+  {
+    arena_clear(arena);
+    return;
+  }
+
+  // Record the highest usage so the arena can anticipate it next time.
+  arena_done_with_block(arena);
+
+  bool same_block = arena->block == mark.block;
+  ArenaBlockHeader * block = arena->block;
+  while (block != mark.block)
+  {
+    assert(block);
+    ArenaBlockHeader * prev = block->prev;
+    arena_free_block(arena, block);
+    block = prev;
+  }
+
+  // Free the blocks for large allocations inserted behind the mark's block.
+  while (block->prev != mark.block_prev)
+  {
+    assert(block->prev);
+    ArenaBlockHeader * large_block = block->prev;
+    block->prev = large_block->prev;
+    arena_free_block(arena, large_block);
+  }
+
+  // The remembered tails might be in blocks we freed.
+  arena_forget_tails(arena);
+
+  assert(mark.remainder >= (uintptr_t)block + arena_block_overhead);
+  assert(mark.remainder <= (uintptr_t)block + block->size);
+  if (same_block)
+  {
+    arena_mark_dirty(arena);
+  }
+  else
+  {
+    // We don't know how much of the earlier block was used, or where it
+    // came from.
+    arena->block_dirty_end = (uintptr_t)block + block->size;
+    arena->block_discard_zeroes = false;
+  }
+  arena->block = block;
+  arena->block_last_allocation = 0;
+  arena->block_remainder = mark.remainder;
+  arena->block_end = (uintptr_t)block + block->size;
+  arena->size_estimate = mark.size_estimate;
+}
+
+//// Scratch arenas ////////////////////////////////////////////////////////////
+// Each thread has ARENA_SCRATCH_COUNT (2 by default) arenas for temporary
+// allocations.  A function that needs temporary memory can call
+// arena_scratch_begin, passing it any arenas it was given by its caller (for
+// example, an arena it is supposed to allocate its result from), and it
+// returns one of the scratch arenas that is not one of those.  That prevents
+// temporary allocations from being interleaved with allocations from the
+// caller's arena, which would waste memory and stop arena_resize from
+// working on the caller's containers.  Call arena_scratch_end when you are
+// done to free everything allocated from the scratch arena since then,
+// retaining its memory for the next use:
+//
+//   char * get_name(Arena * arena, int id)
+//   {
+//     ArenaScratch scratch = arena_scratch_begin(arena);
+//     char * tmp = astr_create(scratch.arena, 0);
+//     ...
+//     char * result = arena_puts(arena, tmp);
+//     arena_scratch_end(scratch);
+//     return result;
+//   }
+//
+// Calls to arena_scratch_begin and arena_scratch_end must be nested
+// properly.  The arenas are thread-local, so call arena_scratch_free before
+// a thread exits to free their memory.
+
+typedef struct ArenaScratch
+{
+  Arena * arena;
+  ArenaMark mark;
+} ArenaScratch;
+
+static ARENA_THREAD_LOCAL Arena arena_scratch_arenas[ARENA_SCRATCH_COUNT];
+
+// Returns a scratch arena of the calling thread that is not one of the
+// conflicting arenas in the specified array (which can contain NULLs), and
+// a mark for arena_scratch_end.  Usually you would call this through the
+// arena_scratch_begin macro instead.
+static inline ArenaScratch _arena_scratch_begin(Arena * const * conflicts,
+  size_t conflict_count)
+{
+  for (size_t i = 0; i < ARENA_SCRATCH_COUNT; i++)
+  {
+    Arena * arena = &arena_scratch_arenas[i];
+    bool conflict = false;
+    for (size_t j = 0; j < conflict_count; j++)
+    {
+      if (conflicts[j] == arena) { conflict = true; break; }
+    }
+    if (!conflict)
+    {
+      ArenaScratch scratch = { arena, arena_mark(arena) };
+      return scratch;
+    }
+  }
+  // Increase ARENA_SCRATCH_COUNT if you need to pass more conflicts.
+  assert(0 && "every scratch arena conflicts");
+  abort();
+}
+
+// Frees the allocations made from the scratch arena since the matching call
+// to arena_scratch_begin.
+static inline void arena_scratch_end(ArenaScratch scratch)
+{
+  arena_rewind(scratch.arena, scratch.mark);
+}
+
+// Frees all the memory held by the calling thread's scratch arenas.  Do not
+// call this between arena_scratch_begin and arena_scratch_end.
+static inline void arena_scratch_free()
+{
+  for (size_t i = 0; i < ARENA_SCRATCH_COUNT; i++)
+  {
+    arena_free(&arena_scratch_arenas[i]);
+  }
+}
+
+#ifdef __cplusplus
+
+// Returns a scratch arena that is not any of the arenas passed to this
+// function.  Pass no arguments if there are no conflicts.
+template <typename... Arenas>
+static inline ArenaScratch arena_scratch_begin(Arenas... conflicts)
+{
+  Arena * const list[] = { conflicts..., NULL };
+  return _arena_scratch_begin(list, sizeof...(conflicts));
+}
+
+#else
+
+// Returns a scratch arena that is not any of the arenas passed to this
+// macro.  Pass NULL if there are no conflicts.
+#define arena_scratch_begin(...) _arena_scratch_begin( \
+  (Arena * const[]){ __VA_ARGS__ }, \
+  sizeof((Arena * const[]){ __VA_ARGS__ }) / sizeof(Arena *))
+
+#endif
+
+//// Concurrent arena //////////////////////////////////////////////////////////
+// An ArenaConcurrent is a simpler kind of arena that can be shared between
+// threads: any number of threads can call arena_concurrent_alloc_no_init or
+// arena_concurrent_alloc on it at the same time without any locking.
+//
+// The fast path is a single atomic fetch-and-add on the current block's
+// remainder.  Since the address returned by the fetch-and-add is not known in
+// advance, each allocation reserves (alignment - 1) extra bytes to make sure
+// it can be aligned, so you should prefer small alignments.  When a block runs
+// out of space, each thread that notices allocates a new, larger block and
+// tries to install it with a compare-and-swap.  Only one thread wins, and the
+// others free their blocks and retry with the winning block.
+//
+// ArenaConcurrent does not support arena_resize, the containers in this
+// header, or hashing.  It always gets its blocks from malloc and frees them
+// with free: it has no block allocator callbacks, so the virtual memory,
+// huge page, and block pool allocators cannot be used with it.
+// Zero-initialize it before use.  arena_concurrent_free must only be called
+// after all the threads are done using the arena.
+
+typedef struct ArenaConcurrentBlock
+{
+  ArenaBlockHeader header;
+
+  // The beginning of the free space in this block.  Updated atomically.
+  // This can be larger than 'end' after the block is full.
+  uintptr_t remainder;
+
+  // The end of this block.
+  uintptr_t end;
+} ArenaConcurrentBlock;
+
+static const size_t arena_concurrent_block_overhead = sizeof(ArenaConcurrentBlock) +
+  (-sizeof(ArenaConcurrentBlock) % alignof(max_align_t));
+
+typedef struct ArenaConcurrent
+{
+  // The block we are currently allocating from.  Updated atomically.
+  ArenaConcurrentBlock * block;
+
+  // Callback to use when malloc fails, before ending the program.
+  ArenaNoMemoryCallback no_memory_callback;
+  void * no_memory_callback_data;
+} ArenaConcurrent;
+
+static void arena_concurrent_handle_no_memory(ArenaConcurrent *, size_t)
+  __attribute__((noreturn));
+
+// Handles cases where malloc returned NULL (or the amount of memory we wanted
+// would not even fit in a size_t).
+static void arena_concurrent_handle_no_memory(ArenaConcurrent * arena, size_t code)
+{
+  if (arena->no_memory_callback != NULL)
+  {
+    arena->no_memory_callback(arena->no_memory_callback_data, code);
+  }
+  fprintf(stderr, "Error: out of memory (code %zu)\n", code);
+  exit(1);
+}
+
+// private function: Allocates a new block that can hold 'reserve' bytes and
+// tries to make it the current block.  'old_block' is the block the calling
+// thread saw as current when it ran out of space.
+static void arena_concurrent_grow(ArenaConcurrent * arena,
+  ArenaConcurrentBlock * old_block, size_t reserve)
+{
+  // If another thread already installed a new block, just retry with it.
+  if (__atomic_load_n(&arena->block, __ATOMIC_ACQUIRE) != old_block) { return; }
+
+  size_t min_block_size = arena_concurrent_block_overhead + reserve;
+  if (min_block_size < reserve) { arena_concurrent_handle_no_memory(arena, SIZE_MAX); }
+
+  // Force the next block to be twice as large as the last block.
+  // (Block sizes are always a power of 2.)
+  if (old_block && min_block_size <= old_block->header.size)
+  {
+    min_block_size = old_block->header.size + 1;
+  }
+
+  size_t block_size = ARENA_FIRST_BLOCK_SIZE;
+  while (block_size < min_block_size)
+  {
+    block_size <<= 1;
+    if (block_size == 0) { arena_concurrent_handle_no_memory(arena, SIZE_MAX); }
+  }
+
+  ArenaConcurrentBlock * new_block = (ArenaConcurrentBlock *)malloc(block_size);
+  if (new_block == NULL) { arena_concurrent_handle_no_memory(arena, block_size); }
+  new_block->header.prev = (ArenaBlockHeader *)old_block;
+  new_block->header.size = block_size;
+  new_block->remainder = (uintptr_t)new_block + arena_concurrent_block_overhead;
+  new_block->end = (uintptr_t)new_block + block_size;
+
+  if (!__atomic_compare_exchange_n(&arena->block, &old_block, new_block,
+    false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+  {
+    // Another thread installed a block before us, so use that one instead.
+    free(new_block);
+  }
+}
+
+// Just like arena_concurrent_alloc except the memory is not initialized
+// to zero.  This can be called by multiple threads at the same time.
+static inline void * arena_concurrent_alloc_no_init(ArenaConcurrent * arena,
+  size_t size, size_t alignment)
+{
+  assert(((alignment - 1) & alignment) == 0);
+  size_t reserve = size + alignment - 1;
+  if (reserve < size) { arena_concurrent_handle_no_memory(arena, SIZE_MAX); }
+  while (1)
+  {
+    ArenaConcurrentBlock * block = __atomic_load_n(&arena->block, __ATOMIC_ACQUIRE);
+    if (block)
+    {
+      uintptr_t start = __atomic_fetch_add(&block->remainder, reserve,
+        __ATOMIC_RELAXED);
+      if (start <= block->end && block->end - start >= reserve)
+      {
+        return (void *)arena_align(start, alignment);
+      }
+    }
+    arena_concurrent_grow(arena, block, reserve);
+  }
+}
+
+// Allocates memory from the concurrent arena with the specified size and
+// alignment.  The memory is initialized to zero.  This can be called by
+// multiple threads at the same time.
+static inline void * arena_concurrent_alloc(ArenaConcurrent * arena,
+  size_t size, size_t alignment)
+{
+  void * allocation = arena_concurrent_alloc_no_init(arena, size, alignment);
+  memset(allocation, 0, size);
+  return allocation;
+}
+
+// Returns the total amount of memory the concurrent arena has allocated from
+// the system.  Not thread-safe.
+static inline size_t arena_concurrent_memory_size(const ArenaConcurrent * arena)
+{
+  size_t size = 0;
+  const ArenaBlockHeader * header = (const ArenaBlockHeader *)arena->block;
+  while (header)
+  {
+    size += header->size;
+    header = header->prev;
+  }
+  return size;
+}
+
+// Frees all the concurrent arena's blocks.  Not thread-safe: no other threads
+// can be using the arena while this is running.
+static inline void arena_concurrent_free(ArenaConcurrent * arena)
+{
+  ArenaBlockHeader * block = (ArenaBlockHeader *)arena->block;
+  while (block)
+  {
+    ArenaBlockHeader * prev = block->prev;
+    free(block);
+    block = prev;
+  }
+  arena->block = NULL;
 }
 
 //// Individual helper functions ///////////////////////////////////////////////
@@ -368,6 +1701,84 @@ static inline void arena_free(Arena * arena)
 // one object of the specified type.
 #define arena_alloc1(arena, type) ((type *)arena_alloc(arena, sizeof(type), alignof(type)))
 
+#ifdef __cplusplus
+
+// Constructs an object of type T in the arena, passing the specified
+// arguments to its constructor.  If T has a non-trivial destructor, it is
+// registered with arena_defer so it runs when the arena is cleared, freed,
+// or rewound.
+template <typename T, typename... Args>
+static inline T * arena_new(Arena * arena, Args &&... args)
+{
+  void * memory = arena_alloc_no_init(arena, sizeof(T), alignof(T));
+  T * object = new (memory) T(std::forward<Args>(args)...);
+  if (!std::is_trivially_destructible<T>::value)
+  {
+    arena_defer(arena, [](void * p) { static_cast<T *>(p)->~T(); }, object);
+  }
+  return object;
+}
+
+#endif
+
+// Allocates an array of 'count' objects of the specified size and alignment.
+// The memory is initialized to zero.  Unlike calling arena_alloc with
+// count * size, this function checks for overflow and treats it as an
+// out-of-memory error.
+static inline void * arena_alloc_n(Arena * arena, size_t count, size_t size,
+  size_t alignment)
+{
+  return arena_alloc(arena, arena_array_size(arena, 0, count, size), alignment);
+}
+
+// This is just like arena_alloc_n() except the memory is not initialized.
+static inline void * arena_alloc_n_no_init(Arena * arena, size_t count,
+  size_t size, size_t alignment)
+{
+  return arena_alloc_no_init(arena, arena_array_size(arena, 0, count, size),
+    alignment);
+}
+
+// Macros that call arena_alloc_n or arena_alloc_n_no_init with the right
+// arguments to allocate an array of objects of the specified type.
+#define arena_alloc_array(arena, count, type) \
+  ((type *)arena_alloc_n(arena, count, sizeof(type), alignof(type)))
+#define arena_alloc_array_no_init(arena, count, type) \
+  ((type *)arena_alloc_n_no_init(arena, count, sizeof(type), alignof(type)))
+
+// Allocates 'count' separate objects of the specified size and alignment
+// with a single bounds check, storing pointers to them in objects[0] through
+// objects[count - 1].  The objects are zero-initialized.  This is faster
+// than calling arena_alloc once per object, and unlike arena_alloc_n it
+// works for sizes that are not a multiple of the alignment.  The objects are
+// contiguous, with arena_align(size, alignment) bytes from the start of one
+// to the start of the next.
+static inline void arena_alloc_many(Arena * arena, void ** objects, size_t count,
+  size_t size, size_t alignment)
+{
+  size_t stride = arena_align(size, alignment);
+  uint8_t * p = (uint8_t *)arena_alloc_n(arena, count, stride, alignment);
+  for (size_t i = 0; i < count; i++)
+  {
+    objects[i] = p;
+    p += stride;
+  }
+}
+
+// This is just like arena_alloc_many() except the objects are not
+// initialized.
+static inline void arena_alloc_many_no_init(Arena * arena, void ** objects,
+  size_t count, size_t size, size_t alignment)
+{
+  size_t stride = arena_align(size, alignment);
+  uint8_t * p = (uint8_t *)arena_alloc_n_no_init(arena, count, stride, alignment);
+  for (size_t i = 0; i < count; i++)
+  {
+    objects[i] = p;
+    p += stride;
+  }
+}
+
 // Copies a C string into the arena and returns a pointer to it.
 char * arena_puts(Arena * arena, const char * str)
 {
@@ -453,6 +1864,7 @@ typedef struct AString {
   Arena * arena;
   size_t length;    // not including null terminator
   size_t capacity;  // not including null terminator
+  size_t zeroed_from;  // characters from here to capacity are known to be 0
   size_t magic;
 } AString;
 
@@ -461,13 +1873,15 @@ typedef struct AString {
 static char * astr_create(Arena * arena, size_t capacity)
 {
   AString * astr = (AString *)arena_alloc_no_init(arena,
-    sizeof(AString) + capacity + 1, alignof(AString));
+    arena_array_size(arena, sizeof(AString) + 1, capacity, 1), alignof(AString));
   astr->arena = arena;
   astr->length = 0;
   astr->capacity = capacity;
   astr->magic = MAGIC_ASTR;
   char * str = (char *)astr + sizeof(AString);
   str[0] = 0;
+  astr->zeroed_from = arena_dirty_size(arena, str, capacity + 1);
+  if (astr->zeroed_from == 0) { astr->zeroed_from = 1; }
   return str;
 }
 
@@ -495,7 +1909,7 @@ static inline size_t astr_capacity(const char * str)
 
 // Creates a new AString that is a copy of the specified AString, with a
 // capacity that is greater than or equal to the specified capacity.
-static char * astr_copy(const char * old_str, size_t capacity)
+static inline char * astr_copy(const char * old_str, size_t capacity)
 {
   const AString * old_astr = _astr_header((char *)old_str);
   if (capacity < old_astr->length) { capacity = old_astr->length; }
@@ -504,6 +1918,7 @@ static char * astr_copy(const char * old_str, size_t capacity)
   astr->length = old_astr->length;
   memcpy(str, old_str, astr->length);
   str[astr->length] = 0;
+  if (astr->zeroed_from <= astr->length) { astr->zeroed_from = astr->length + 1; }
   return str;
 }
 
@@ -521,27 +1936,39 @@ static void astr_resize_capacity(char ** str, size_t new_capacity)
     new_capacity = astr->length;
   }
 
-  if (arena_resize(astr->arena, astr, sizeof(AString) + new_capacity + 1))
+  Arena * arena = astr->arena;
+  size_t old_size = sizeof(AString) + astr->capacity + 1;
+  size_t new_size = arena_array_size(arena, sizeof(AString) + 1, new_capacity, 1);
+  if (new_capacity <= astr->capacity)
   {
-    astr->capacity = new_capacity;
+    // If we can't give the space back to the arena, there is no point in
+    // shrinking the string.
+    if (arena_resize(arena, astr, new_size))
+    {
+      if (astr->zeroed_from > new_capacity + 1)
+      {
+        astr->zeroed_from = new_capacity + 1;
+      }
+      astr->capacity = new_capacity;
+    }
     return;
   }
-  else if (new_capacity <= astr->capacity)
+
+  AString * new_astr = (AString *)arena_realloc(arena, astr, old_size,
+    new_size, alignof(AString));
+  if (new_astr != astr)
   {
-    // The user asked to shrink the string but we can't actually give the space
-    // back to the arena, so there is no point.
-    return;
+    // The old string object is not valid anymore: try to prevent its use.
+    _arena_invalidate_magic(&astr->magic);
+    (*str)[0] = 0;
+    *str = (char *)new_astr + sizeof(AString);
   }
 
-  AString * old_astr = astr;
-  char * old_str = *str;
-
-  // Create a new string object that is a copy of the old one.
-  *str = astr_copy(*str, new_capacity);
-
-  // The old string object is not valid anymore: try to prevent its use.
-  _arena_invalidate_magic(&old_astr->magic);
-  old_str[0] = 0;
+  char * new_chars = *str + new_astr->capacity + 1;
+  size_t dirty = arena_dirty_size(arena, new_chars,
+    new_capacity - new_astr->capacity);
+  if (dirty) { new_astr->zeroed_from = new_astr->capacity + 1 + dirty; }
+  new_astr->capacity = new_capacity;
 }
 
 // Set the length of the AString, increasing the capacity if necessary.
@@ -556,7 +1983,11 @@ static void astr_set_length(char ** str, size_t length)
   }
   if (length > astr->length)
   {
-    memset(*str + astr->length, 0, 1 + length - astr->length);
+    // Characters at zeroed_from and beyond are already zero.
+    size_t end = length + 1;
+    if (end > astr->zeroed_from) { end = astr->zeroed_from; }
+    memset(*str + astr->length, 0, end - astr->length);
+    if (astr->zeroed_from <= length) { astr->zeroed_from = length + 1; }
   }
   else
   {
@@ -596,6 +2027,7 @@ static inline void astr_puts(char ** str, const char * cstr)
   }
   memcpy(*str + astr->length, cstr, cstrlen + 1);
   astr->length = new_length;
+  if (astr->zeroed_from <= new_length) { astr->zeroed_from = new_length + 1; }
   assert((*str)[astr->length] == 0);
 }
 
@@ -614,6 +2046,11 @@ static int astr_vprintf(char ** str, const char * format, va_list ap)
     va_copy(ap2, ap);
     int result = vsnprintf(target, available, format, ap2);
     va_end(ap2);
+    size_t written = (size_t)result < available ? (size_t)result + 1 : available;
+    if (result >= 0 && astr->zeroed_from < astr->length + written)
+    {
+      astr->zeroed_from = astr->length + written;
+    }
     if (result < 0)
     {
       // This error probably never happens.  But if it does, we should give
@@ -673,10 +2110,16 @@ void astr_write_at_offset(char ** str, size_t offset, size_t size,
   {
     if (astr->length < offset)
     {
-      memset(*str + astr->length, 0, offset - astr->length);
+      // Characters at zeroed_from and beyond are already zero.
+      size_t end = offset < astr->zeroed_from ? offset : astr->zeroed_from;
+      memset(*str + astr->length, 0, end - astr->length);
     }
     (*str)[required_length] = 0;
     astr->length = required_length;
+    if (astr->zeroed_from <= required_length)
+    {
+      astr->zeroed_from = required_length + 1;
+    }
   }
   memcpy(*str + offset, data, size);
 }
@@ -829,6 +2272,7 @@ typedef struct AList {
   Arena * arena;
   size_t length;    // number of items stored, not counting the NULL terminator
   size_t capacity;  // maximum length we can accomodate without resizing
+  size_t zeroed_from;  // items from here to capacity are known to be zero
   uint32_t item_size;
   size_t magic;
 } AList;
@@ -843,7 +2287,8 @@ static void * _ali_create(Arena * arena, size_t capacity, size_t item_size, size
   assert(item_size % item_alignment == 0);
 
   if (capacity == 0) { capacity = ARENA_SMALL_LIST_SIZE; }
-  size_t size = sizeof(AList) + (capacity + 1) * item_size;
+  size_t size = arena_array_size(arena, sizeof(AList) + item_size,
+    capacity, item_size);
   AList * ali = (AList *)arena_alloc_no_init(arena, size, alignof(AList));
   ali->arena = arena;
   ali->length = 0;
@@ -851,7 +2296,10 @@ static void * _ali_create(Arena * arena, size_t capacity, size_t item_size, size
   ali->item_size = item_size;
   ali->magic = MAGIC_ALI;
   void * list = (void *)((uint8_t *)ali + sizeof(AList));
-  memset(list, 0, item_size);
+  size_t dirty = arena_dirty_size(arena, list, size - sizeof(AList));
+  ali->zeroed_from = (dirty + item_size - 1) / item_size;
+  if (ali->zeroed_from) { memset(list, 0, item_size); }
+  else { ali->zeroed_from = 1; }
   return list;
 }
 
@@ -881,7 +2329,7 @@ static inline size_t _ali_capacity(const void * list)
   return _ali_header(list)->capacity;
 }
 
-static void * _ali_copy(const void * old_list, size_t capacity)
+static inline void * _ali_copy(const void * old_list, size_t capacity)
 {
   AList * old_h = _ali_header(old_list);
 
@@ -892,6 +2340,7 @@ static void * _ali_copy(const void * old_list, size_t capacity)
 
   h->length = old_h->length;
   memcpy(list, old_list, (old_h->length + 1) * old_h->item_size);
+  if (h->zeroed_from <= h->length) { h->zeroed_from = h->length + 1; }
   return list;
 }
 
@@ -902,28 +2351,48 @@ static void _ali_resize_capacity(void ** list, size_t new_capacity)
 
   if (new_capacity < h->length) { new_capacity = h->length; }
 
-  size_t size = sizeof(AList) + (new_capacity + 1) * h->item_size;
-  if (arena_resize(h->arena, h, size))
+  // The items usually start right after the header, but ali_drop can leave
+  // some padding between them.
+  Arena * arena = h->arena;
+  size_t offset = (uint8_t *)*list - (uint8_t *)h;
+  size_t old_size = offset + (h->capacity + 1) * h->item_size;
+  size_t new_size = arena_array_size(arena, offset + h->item_size,
+    new_capacity, h->item_size);
+  if (new_capacity <= h->capacity)
   {
-    h->capacity = new_capacity;
+    // If we cannot give the memory back to the arena, there is no point in
+    // shrinking the capacity of the list.
+    if (arena_resize(arena, h, new_size))
+    {
+      if (h->zeroed_from > new_capacity + 1)
+      {
+        h->zeroed_from = new_capacity + 1;
+      }
+      h->capacity = new_capacity;
+    }
     return;
   }
-  else if (new_capacity <= h->capacity)
+
+  AList * new_h = (AList *)arena_realloc(arena, h, old_size, new_size,
+    alignof(AList));
+  if (new_h != h)
   {
-    // The user asked to shrink the capacity of the list, but we cannot give
-    // that memory back to the arena, so there is no point.
-    return;
+    // The old object is not valid anymore: try to prevent its use.
+    _arena_invalidate_magic(&h->magic);
+    h->length = 0;
+    memset(*list, 0, h->item_size);
+    *list = (uint8_t *)new_h + offset;
   }
 
-  AList * old_h = h;
-  void * old_list = *list;
-
-  *list = _ali_copy(old_list, new_capacity);
-
-  // The old object is not valid anymore: try to prevent its use.
-  _arena_invalidate_magic(&old_h->magic);
-  old_h->length = 0;
-  memset(old_h, 0, old_h->item_size);
+  uint8_t * new_items = (uint8_t *)*list + (new_h->capacity + 1) * new_h->item_size;
+  size_t dirty = arena_dirty_size(arena, new_items,
+    (new_capacity - new_h->capacity) * new_h->item_size);
+  if (dirty)
+  {
+    new_h->zeroed_from = new_h->capacity + 1 +
+      (dirty + new_h->item_size - 1) / new_h->item_size;
+  }
+  new_h->capacity = new_capacity;
 }
 
 static inline void _ali_set_length(void ** list, size_t length)
@@ -937,16 +2406,28 @@ static inline void _ali_set_length(void ** list, size_t length)
   }
   if (length > h->length)
   {
-    memset((uint8_t *)*list + h->length * h->item_size, 0, (length - h->length) * h->item_size);
+    // Items at zeroed_from and beyond are already zero.
+    size_t end = length + 1;
+    if (end > h->zeroed_from) { end = h->zeroed_from; }
+    memset((uint8_t *)*list + h->length * h->item_size, 0, (end - h->length) * h->item_size);
+    if (h->zeroed_from <= length) { h->zeroed_from = length + 1; }
+  }
+  else
+  {
+    memset((uint8_t *)*list + length * h->item_size, 0, h->item_size);
   }
   h->length = length;
-  memset((uint8_t *)*list + h->length * h->item_size, 0, h->item_size);
 }
 
-static inline void * _ali_push0(void ** list)
+// Adds an item to the end of the list and returns a pointer to it, leaving
+// it uninitialized.  The item size is passed in (even though the header has
+// it) so that when this is inlined into typed code, the compiler can see it
+// is a constant.
+static inline void * _ali_push0(void ** list, size_t item_size)
 {
   assert(list);
   AList * h = _ali_header(*list);
+  assert(item_size == h->item_size);
   if (h->length >= h->capacity)
   {
     size_t new_capacity = h->length + 1;
@@ -955,8 +2436,15 @@ static inline void * _ali_push0(void ** list)
     h = _ali_header(*list);
   }
   h->length++;
-  memset((uint8_t *)*list + h->length * h->item_size, 0, h->item_size);
-  return (uint8_t *)*list + (h->length - 1) * h->item_size;
+  if (h->length < h->zeroed_from)
+  {
+    memset((uint8_t *)*list + h->length * item_size, 0, item_size);
+  }
+  else
+  {
+    h->zeroed_from = h->length + 1;  // the new terminator is already zero
+  }
+  return (uint8_t *)*list + (h->length - 1) * item_size;
 }
 
 static inline void _ali_drop(void ** list, size_t count)
@@ -970,6 +2458,7 @@ static inline void _ali_drop(void ** list, size_t count)
   memmove(new_h, h, sizeof(AList));
   new_h->capacity -= count;
   new_h->length -= count;
+  new_h->zeroed_from -= count;
 }
 
 #define ali_create(arena, capacity, T) ((T *)_ali_create((arena), (capacity), sizeof(T), alignof(T)))
@@ -995,7 +2484,7 @@ template<typename T> static inline void ali_set_length(T * & list, size_t length
 
 template<typename T, typename U> static inline void ali_push(T * & list, U item)
 {
-  *(T *)_ali_push0((void **)&list) = item;
+  *(T *)_ali_push0((void **)&list, sizeof(T)) = item;
 }
 
 template<typename T> static inline void ali_drop(T * & list, size_t count)
@@ -1007,7 +2496,7 @@ template<typename T> static inline void ali_drop(T * & list, size_t count)
 #define ali_copy(list, cap) ((typeof_unqual(*list)*)_ali_copy((list), cap))
 #define ali_resize_capacity(list, cap) (_ali_resize_capacity(_ARENA_PP(&list), cap))
 #define ali_set_length(list, length) (_ali_set_length(_ARENA_PP(&list), length))
-#define ali_push(list, item) (*(typeof(list))_ali_push0(_ARENA_PP(&list)) = (item))
+#define ali_push(list, item) (*(typeof(list))_ali_push0(_ARENA_PP(&list), sizeof(*(list))) = (item))
 #define ali_drop(list, count) (_ali_drop(_ARENA_PP(&list), (count)))
 #endif
 
@@ -1071,7 +2560,7 @@ template<typename T> static inline void ali_drop(T * & list, size_t count)
         v2 = ROTL(v2, 16);                                                     \
     } while (0)
 
-static int arena_halfsiphash(const uint8_t *in, const size_t inlen, const uint8_t *k,
+static inline int arena_halfsiphash(const uint8_t *in, const size_t inlen, const uint8_t *k,
                 uint8_t *out, const size_t outlen) {
 
     assert((outlen == 4) || (outlen == 8));
@@ -1174,7 +2663,7 @@ typedef uint32_t ArenaHashInt;
 // Initializes the arena's hash key, if it is not already initialized.
 // You do not need to call this directly: the key is automatically
 // initialized when needed.
-static void arena_hash_key_init(Arena * arena)
+static inline void arena_hash_key_init(Arena * arena)
 {
   while (arena->hash_key == 0)
   {
@@ -1185,21 +2674,144 @@ static void arena_hash_key_init(Arena * arena)
   }
 }
 
-// Calculates the hash of the specified data.
+// private functions: Helpers for arena_wyhash.
+static _ARENA_ALWAYS_INLINE uint64_t arena_wyr8(const uint8_t * p)
+{
+  uint64_t v;
+  memcpy(&v, p, 8);
+  return v;
+}
+
+static _ARENA_ALWAYS_INLINE uint64_t arena_wyr4(const uint8_t * p)
+{
+  uint32_t v;
+  memcpy(&v, p, 4);
+  return v;
+}
+
+// Multiplies a and b, returning the low 64 bits in a and the high 64 bits
+// in b.
+static _ARENA_ALWAYS_INLINE void arena_wymum(uint64_t * a, uint64_t * b)
+{
+#ifdef __SIZEOF_INT128__
+  __uint128_t r = (__uint128_t)*a * *b;
+  *a = (uint64_t)r;
+  *b = (uint64_t)(r >> 64);
+#else
+  uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32), c = t < rl;
+  uint64_t lo = t + (rm1 << 32);
+  c += lo < t;
+  *a = lo;
+  *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static _ARENA_ALWAYS_INLINE uint64_t arena_wymix(uint64_t a, uint64_t b)
+{
+  arena_wymum(&a, &b);
+  return a ^ b;
+}
+
+// A fast 64-bit hash function based on wyhash (https://github.com/wangyi-fudan/wyhash).
+static inline uint64_t arena_wyhash(const uint8_t * p, size_t length, uint64_t seed)
+{
+  const uint64_t s0 = 0xa0761d6478bd642full, s1 = 0xe7037ed1a0b428dbull;
+  const uint64_t s2 = 0x8ebc6af09c88c6e3ull, s3 = 0x589965cc75374cc3ull;
+  seed ^= arena_wymix(seed ^ s0, s1);
+  uint64_t a, b;
+  if (length <= 16)
+  {
+    if (length >= 4)
+    {
+      size_t d = (length >> 3) << 2;
+      a = (arena_wyr4(p) << 32) | arena_wyr4(p + d);
+      b = (arena_wyr4(p + length - 4) << 32) | arena_wyr4(p + length - 4 - d);
+    }
+    else if (length > 0)
+    {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[length >> 1] << 8) | p[length - 1];
+      b = 0;
+    }
+    else
+    {
+      a = b = 0;
+    }
+  }
+  else
+  {
+    size_t i = length;
+    if (i > 48)
+    {
+      uint64_t see1 = seed, see2 = seed;
+      do
+      {
+        seed = arena_wymix(arena_wyr8(p) ^ s1, arena_wyr8(p + 8) ^ seed);
+        see1 = arena_wymix(arena_wyr8(p + 16) ^ s2, arena_wyr8(p + 24) ^ see1);
+        see2 = arena_wymix(arena_wyr8(p + 32) ^ s3, arena_wyr8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= see1 ^ see2;
+    }
+    while (i > 16)
+    {
+      seed = arena_wymix(arena_wyr8(p) ^ s1, arena_wyr8(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
+    }
+    a = arena_wyr8(p + i - 16);
+    b = arena_wyr8(p + i - 8);
+  }
+  a ^= s1;
+  b ^= seed;
+  arena_wymum(&a, &b);
+  return arena_wymix(a ^ s0 ^ length, b ^ s1);
+}
+
+// Calculates the hash of the specified data with the specified hash function.
 // Never returns 0 (the empty value).
-static ArenaHashInt arena_hash(Arena * arena,
-  const uint8_t * data, size_t length)
+static inline ArenaHashInt arena_hash_using(Arena * arena,
+  ArenaHashFunction function, const uint8_t * data, size_t length)
 {
   arena_hash_key_init(arena);
   ArenaHashInt out;
-  arena_halfsiphash(data, length, (uint8_t *)&arena->hash_key,
-    (uint8_t *)&out, sizeof(out));
+  if (function == ARENA_HASH_FAST)
+  {
+    if (length == 4 || length == 8)
+    {
+      // One 64x64->128 bit multiply, folding the high half of the product
+      // into the low half.  The low bits of a product only depend on the low
+      // bits of the key, so without the fold, keys that differ only in their
+      // high bits (like shifted IDs or tagged pointers) would collide.
+      uint64_t k = length == 8 ? arena_wyr8(data) : arena_wyr4(data);
+      out = (ArenaHashInt)arena_wymix(k ^ arena->hash_key, 0x9e3779b97f4a7c15ull);
+    }
+    else
+    {
+      out = (ArenaHashInt)arena_wyhash(data, length, arena->hash_key);
+    }
+  }
+  else
+  {
+    arena_halfsiphash(data, length, (uint8_t *)&arena->hash_key,
+      (uint8_t *)&out, sizeof(out));
+  }
   if (out == 0) { out = 1; }
   return out;
 }
 
+// Calculates the hash of the specified data using the arena's hash function.
+// Never returns 0 (the empty value).
+static inline ArenaHashInt arena_hash(Arena * arena,
+  const uint8_t * data, size_t length)
+{
+  return arena_hash_using(arena, arena->hash_function, data, length);
+}
+
 // Calculates the hash of the specified string.  Never returns 0.
-static ArenaHashInt arena_hash_from_string(Arena * arena,
+static inline ArenaHashInt arena_hash_from_string(Arena * arena,
   const char * str)
 {
   return arena_hash(arena, (const uint8_t *)str, strlen(str));
@@ -1232,14 +2844,29 @@ typedef struct AByteSlice {
 //   T items[capacity + 1];
 //
 // One of the members in the header points to a table used to find items:
-//   ArenaHashInt hash_table[capacity * 4];
+//   AHashSlot hash_table[capacity * 2];
+//   uint8_t control[capacity * 2 + 16];
+//
+// When we add an item to the table, the index of the slot we use for it is
+// determined in part by the lower bits of the hash of its key, making it
+// possible to quickly find the slot later.  Each slot stores the full hash
+// of the item's key (or 0 if the slot is empty) next to the index of the
+// item in the array, so checking a slot only touches one cache line.
 //
-// There are capacity * 2 slots in the hash table.  When we add an item to the
-// table, the index of the slot we use for it is determined in part by the
-// lower bits of the hash of its key, making it possible to quickly find
-// the slot later.  The first half of the hash table stores the full hash
-// of the item's key, or 0 if the slot is empty.  The second half of the hash
-// table stores the index of the item in the array.
+// Each slot also has a control byte, which is 0 if the slot is empty, or
+// otherwise has its top bit set and 7 more bits of the hash (a tag).  Lookups
+// check the control bytes of 16 consecutive slots at a time (using SSE2 if
+// available), and only look at slots whose tag matches.  The last 16
+// control bytes are copies of the first ones so that a group of 16 never
+// needs to wrap around.
+//
+// Normally, when the hash grows, all the slots are moved to a larger table at
+// once.  After ahash_enable_incremental_growth, the hash instead keeps the
+// old table, and moves AHASH_MIGRATION_STEP of its slots to the new table
+// each time an item is added.  Until that finishes, lookups that miss in the
+// new table also search the old one.  Deleting an item from the old table
+// just sets its control byte to 1 (deleted), which keeps the probe sequences
+// of the old table intact.
 //
 // The capacity is always a power of 2.
 //
@@ -1307,6 +2934,26 @@ typedef struct AByteSlice {
 //   If you're curious why the ahash_find have to be separate ahash_find_p macros, see:
 //   https://gist.github.com/DavidEGrayson/44a54453af0ea0ec890c615b81dbbd0c
 //
+// void ahash_find_batch(const T * hash, const TK * keys, size_t count, T ** results);
+//   Looks up 'count' keys and stores a pointer to each item found (or NULL)
+//   in the corresponding element of 'results'.  This is equivalent to
+//   calling ahash_find for each key, but it is faster for tables that do not
+//   fit in the cache: it computes the hashes of several keys and prefetches
+//   their slots before probing, and prefetches the items before comparing
+//   keys, so the cache misses for different keys overlap.
+//
+// T * ahash_find_str_n(const T * hash, const char * str, size_t length);
+// T * ahash_find_or_update_str_n(T * & hash, const char * str, size_t length, bool * found);
+//   These are like ahash_find and ahash_find_or_update, but only work for
+//   hashes with the AKEY_STRING key type, and take the key as a pointer and a
+//   length instead of a null-terminated string, so you can look up a token in
+//   a larger buffer without copying it first.  If the key is not found,
+//   ahash_find_or_update_str_n copies it into the arena as a null-terminated
+//   string, and adds an item whose key points to the copy and whose other
+//   members are zero.  Since the keys in the table are null-terminated
+//   strings, ahash_find_str_n never finds a key that contains a null byte,
+//   and ahash_find_or_update_str_n must not be given one.
+//
 // T * ahash_update(T * & hash, const T * item);
 // T * ahash_update(T * & hash, T item);
 //   Copies the specified item into the hash table and returns a pointer to its
@@ -1327,26 +2974,82 @@ typedef struct AByteSlice {
 //   Deletes the item with the specified key, removing it from the array and
 //   moving the last item in the array to take its place.  Returns true if an
 //   item was deleted.
+//
+// void ahash_set_hash_function(T * hash, ArenaHashFunction function)
+//   Changes the hash function used by the hash, rebuilding its table if
+//   needed.  A new hash uses the hash_function of its arena, which defaults
+//   to ARENA_HASH_SIPHASH.  Use ARENA_HASH_FAST for better performance if
+//   the keys are trusted.
+//
+// void ahash_enable_fast_delete(T * hash)
+//   Makes the hash store the hash of each item (4 more bytes of memory per
+//   item of capacity), so that when ahash_delete moves the final item into
+//   the place of a deleted item, it can find the final item's slot without
+//   hashing its key again.  This makes deletion faster, especially for
+//   string keys.
+//
+// void ahash_enable_incremental_growth(T * hash)
+//   Makes the hash grow incrementally (see above), so that no single
+//   insertion has to move every slot of a large table.  This is useful if you
+//   care more about the worst-case latency of an insertion than about total
+//   throughput.  Growing still copies the items themselves.
+//
+// T * ahash_fixed_find(const T * hash, TK key)
+// T * ahash_fixed_find_or_update(T * & hash, T item, bool * found)
+// T * ahash_fixed_update(T * & hash, T item)
+// bool ahash_fixed_delete(T * hash, TK key)
+//   These are equivalent to the functions above, but they only work for
+//   hashes with the AKEY_DEFAULT key type, and they use sizeof(TK) and
+//   sizeof(T) instead of the sizes stored in the hash at run time.  That lets
+//   the compiler specialize the hashing, probing, and key comparison for the
+//   key type, so lookups of small keys like integer IDs are much faster.
+//   They can be mixed freely with the generic functions on the same hash.
+//   For example, with GCC at -O2, ahash_fixed_find with a uint32_t key
+//   compiles to inline code that hashes the key, probes the table, and
+//   compares keys with a single 32-bit comparison.  The only call it makes
+//   is to HalfSipHash (unless the hash uses ARENA_HASH_FAST), and there is
+//   no call to _ahash_find or memcmp.
 
 typedef enum AKeyType : uint8_t {
   AKEY_DEFAULT = 0,
   AKEY_STRING = 1,
   AKEY_BYTE_SLICE = 2,
+
+  // Used internally by ahash_find_str_n: the key we are looking up is an
+  // AByteSlice, but the keys in the hash are AKEY_STRING.
+  _AKEY_STRING_N = 3,
 } AKeyType;
 
 static const size_t ahash_max_capacity = (ArenaHashInt)-1 / 2 + 1;
 
+typedef struct AHashSlot {
+  ArenaHashInt hash;   // hash of the item's key, or 0 if the slot is empty
+  ArenaHashInt index;  // index of the item in the array
+} AHashSlot;
+
 typedef struct AHash {
   Arena * arena;
-  ArenaHashInt * table;
+  AHashSlot * table;
   ArenaHashInt length;    // number of items stored, not counting the NULL terminator
   ArenaHashInt capacity;  // maximum length we can accomodate without resizing (power of 2)
   uint32_t item_size;
   uint32_t key_size;
   AKeyType key_type;
+  ArenaHashFunction hash_function;
+  uint8_t flags;
+  ArenaHashInt migrated;      // number of slots of old_table moved to table
+  AHashSlot * old_table;      // table being moved during incremental growth, or NULL
+  ArenaHashInt old_capacity;  // capacity of old_table
   size_t magic;
 } AHash;
 
+// Flags for AHash:
+#define _AHASH_ITEM_HASHES 1  // The table has the hash of each item (see ahash_enable_fast_delete).
+#define _AHASH_INCREMENTAL 2  // Grow incrementally (see ahash_enable_incremental_growth).
+
+// Control byte for a slot of the old table whose item was deleted or moved.
+#define _AHASH_CONTROL_DELETED 1
+
 // Calculate the actual capacity to use for an AHash.  It will be at least
 // as large as the reuqested capacity, but if the requested capcaity is too
 // large then this function does not return and triggers the no memory
@@ -1369,15 +3072,100 @@ static size_t _ahash_calculate_capacity(Arena * arena, size_t requested)
 }
 
 // Calculate the number of bytes needed for the main portion of an AHash.
-static inline size_t _ahash_main_size(size_t capacity, size_t item_size)
+static inline size_t _ahash_main_size(Arena * arena, size_t capacity, size_t item_size)
 {
-  return sizeof(AHash) + (capacity + 1) * item_size;
+  return arena_array_size(arena, sizeof(AHash) + item_size, capacity, item_size);
+}
+
+// Calculates the offset of the item hashes in the hash table portion of an
+// AHash, which is also the size of that portion if it has no item hashes.
+static inline size_t _ahash_item_hashes_offset(size_t capacity)
+{
+  size_t offset = (capacity * 2) * (sizeof(AHashSlot) + 1) + 16;
+  return (offset + alignof(ArenaHashInt) - 1) & ~(alignof(ArenaHashInt) - 1);
 }
 
 // Calculates the number of bytes needed for the hash table portion of an AHash.
-static inline size_t _ahash_table_size(size_t capacity)
+static inline size_t _ahash_table_size(size_t capacity, uint8_t flags)
+{
+  size_t size = _ahash_item_hashes_offset(capacity);
+  if (flags & _AHASH_ITEM_HASHES) { size += capacity * sizeof(ArenaHashInt); }
+  return size;
+}
+
+// Returns a pointer to the array that holds the hash of each item.  Only
+// valid if the _AHASH_ITEM_HASHES flag is set.
+static _ARENA_ALWAYS_INLINE ArenaHashInt * _ahash_item_hashes(const AHash * ahash)
+{
+  assert(ahash->flags & _AHASH_ITEM_HASHES);
+  return (ArenaHashInt *)((uint8_t *)ahash->table +
+    _ahash_item_hashes_offset(ahash->capacity));
+}
+
+//// AHash control bytes
+
+// Returns a pointer to the control bytes of the hash table.
+static _ARENA_ALWAYS_INLINE uint8_t * _ahash_control(const AHash * ahash)
+{
+  return (uint8_t *)(ahash->table + ahash->capacity * 2);
+}
+
+// Returns the control byte for a slot that holds an item with the specified
+// hash value.  We use the top bits of the hash because the low bits
+// determine the slot.
+static _ARENA_ALWAYS_INLINE uint8_t _ahash_tag(ArenaHashInt hv)
+{
+  return 0x80 | (uint8_t)(hv >> (sizeof(ArenaHashInt) * 8 - 7));
+}
+
+// Returns a pointer to the control bytes of the old table, during
+// incremental growth.
+static inline uint8_t * _ahash_old_control(const AHash * ahash)
+{
+  return (uint8_t *)(ahash->old_table + ahash->old_capacity * 2);
+}
+
+// Sets the control byte of a slot, and its copies at the end.
+static _ARENA_ALWAYS_INLINE void _ahash_set_control_in(uint8_t * control, size_t slot_count,
+  size_t slot, uint8_t value)
+{
+  for (size_t i = slot; i < slot_count + 16; i += slot_count)
+  {
+    control[i] = value;
+  }
+}
+
+static _ARENA_ALWAYS_INLINE void _ahash_set_control(const AHash * ahash, size_t slot,
+  uint8_t value)
 {
-  return (capacity * 4) * sizeof(ArenaHashInt);
+  _ahash_set_control_in(_ahash_control(ahash), ahash->capacity * 2, slot, value);
+}
+
+// Returns a bit mask of the slots in a group of 16 that have the
+// specified control byte.
+static _ARENA_ALWAYS_INLINE uint32_t _ahash_group_match(const uint8_t * group, uint8_t tag)
+{
+#ifdef __SSE2__
+  __m128i g = _mm_loadu_si128((const __m128i *)group);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)tag)));
+#else
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < 16; i++) { mask |= (uint32_t)(group[i] == tag) << i; }
+  return mask;
+#endif
+}
+
+// Returns a bit mask of the empty slots in a group of 16.
+static _ARENA_ALWAYS_INLINE uint32_t _ahash_group_empty(const uint8_t * group)
+{
+#ifdef __SSE2__
+  __m128i g = _mm_loadu_si128((const __m128i *)group);
+  return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_setzero_si128()));
+#else
+  uint32_t mask = 0;
+  for (uint32_t i = 0; i < 16; i++) { mask |= (uint32_t)(group[i] == 0) << i; }
+  return mask;
+#endif
 }
 
 static inline void * _ahash_create(Arena * arena, size_t capacity, AKeyType type,
@@ -1401,12 +3189,12 @@ static inline void * _ahash_create(Arena * arena, size_t capacity, AKeyType type
   capacity = _ahash_calculate_capacity(arena, capacity);
 
   AHash * ahash = (AHash *)arena_alloc_no_init(arena,
-    _ahash_main_size(capacity, item_size), alignof(AHash));
+    _ahash_main_size(arena, capacity, item_size), alignof(AHash));
   memset(ahash, 0, sizeof(AHash));
 
-  assert(alignof(AHash) % alignof(ArenaHashInt) == 0);
-  ahash->table = (ArenaHashInt *)arena_alloc(arena,
-    _ahash_table_size(capacity), alignof(AHash));
+  assert(alignof(AHash) % alignof(AHashSlot) == 0);
+  ahash->table = (AHashSlot *)arena_alloc(arena,
+    _ahash_table_size(capacity, 0), alignof(AHash));
 
   ahash->arena = arena;
   ahash->length = 0;
@@ -1415,13 +3203,14 @@ static inline void * _ahash_create(Arena * arena, size_t capacity, AKeyType type
   assert(item_size == ahash->item_size);
   ahash->key_type = type;
   ahash->key_size = key_size;
+  ahash->hash_function = arena->hash_function;
   ahash->magic = MAGIC_AHASH;
   void * list = ahash + 1;
   memset(list, 0, item_size);
   return list;
 }
 
-static inline AHash * _ahash_header(const void * hash)
+static _ARENA_ALWAYS_INLINE AHash * _ahash_header(const void * hash)
 {
   assert(hash && ((size_t *)hash)[-1] == (size_t)MAGIC_AHASH);
   return (AHash *)((uint8_t *)hash - sizeof(AHash));
@@ -1438,17 +3227,47 @@ static inline size_t _ahash_capacity(const void * hash)
   return _ahash_header(hash)->capacity;
 }
 
-static void * _ahash_copy(const void * old_hash, size_t capacity)
+// Moves up to 'count' slots from the old table to the new table during
+// incremental growth, and discards the old table once they are all moved.
+static void _ahash_migrate(AHash * ahash, size_t count)
+{
+  AHashSlot * old_table = ahash->old_table;
+  uint8_t * old_control = _ahash_old_control(ahash);
+  size_t old_slot_count = ahash->old_capacity * 2;
+  AHashSlot * table = ahash->table;
+  ArenaHashInt mask = ahash->capacity * 2 - 1;
+  size_t end = ahash->migrated;
+  end += count < old_slot_count - end ? count : old_slot_count - end;
+  for (size_t s = ahash->migrated; s < end; s++)
+  {
+    if (!(old_control[s] & 0x80)) { continue; }  // skip empty and deleted slots
+    ArenaHashInt slot = old_table[s].hash & mask;
+    while (table[slot].hash) { slot = (slot + 1) & mask; }
+    table[slot] = old_table[s];
+    _ahash_set_control(ahash, slot, _ahash_tag(old_table[s].hash));
+    _ahash_set_control_in(old_control, old_slot_count, s, _AHASH_CONTROL_DELETED);
+  }
+  ahash->migrated = end;
+  if (end == old_slot_count)
+  {
+    ahash->old_table = NULL;
+    ahash->old_capacity = 0;
+    ahash->migrated = 0;
+  }
+}
+
+// Creates a new AHash with a copy of the items of the specified AHash, and
+// an empty table.
+static void * _ahash_copy_items(const void * old_hash, size_t capacity)
 {
   const AHash * old_ahash = _ahash_header(old_hash);
-  const ArenaHashInt * old_table = old_ahash->table;
 
   if (capacity < old_ahash->length) { capacity = old_ahash->length; }
   capacity = _ahash_calculate_capacity(old_ahash->arena, capacity);
 
   // Create the new header.
   AHash * ahash = (AHash *)arena_alloc_no_init(old_ahash->arena,
-    _ahash_main_size(capacity, old_ahash->item_size), alignof(AHash));
+    _ahash_main_size(old_ahash->arena, capacity, old_ahash->item_size), alignof(AHash));
   memset(ahash, 0, sizeof(AHash));
   ahash->arena = old_ahash->arena;
   ahash->length = old_ahash->length;
@@ -1456,6 +3275,8 @@ static void * _ahash_copy(const void * old_hash, size_t capacity)
   ahash->item_size = old_ahash->item_size;
   ahash->key_type = old_ahash->key_type;
   ahash->key_size = old_ahash->key_size;
+  ahash->hash_function = old_ahash->hash_function;
+  ahash->flags = old_ahash->flags;
   ahash->magic = MAGIC_AHASH;
 
   // Copy the items and the null terminator.
@@ -1463,17 +3284,43 @@ static void * _ahash_copy(const void * old_hash, size_t capacity)
   memcpy(hash, old_hash, (ahash->length + 1) * ahash->item_size);
 
   // Create the new table.
-  assert(alignof(AHash) % alignof(ArenaHashInt) == 0);
-  ArenaHashInt * table = ahash->table = (ArenaHashInt *)arena_alloc(
-    old_ahash->arena, _ahash_table_size(capacity), alignof(AHash));
-  for (size_t s = 0; s < old_ahash->capacity * 2; s++)
-  {
-    if (old_table[s] == 0) { continue; }  // skip empty slots
-    ArenaHashInt mask = capacity * 2 - 1;
-    ArenaHashInt slot = old_table[s] & mask;
-    while (table[slot]) { slot = (slot + 1) & mask; }
-    table[slot] = old_table[s];
-    table[2 * capacity + slot] = old_table[2 * old_ahash->capacity + s];
+  assert(alignof(AHash) % alignof(AHashSlot) == 0);
+  ahash->table = (AHashSlot *)arena_alloc(old_ahash->arena,
+    _ahash_table_size(capacity, ahash->flags), alignof(AHash));
+  if (ahash->flags & _AHASH_ITEM_HASHES)
+  {
+    memcpy(_ahash_item_hashes(ahash), _ahash_item_hashes(old_ahash),
+      ahash->length * sizeof(ArenaHashInt));
+  }
+
+  return hash;
+}
+
+static void * _ahash_copy(const void * old_hash, size_t capacity)
+{
+  const AHash * old_ahash = _ahash_header(old_hash);
+  void * hash = _ahash_copy_items(old_hash, capacity);
+  AHash * ahash = _ahash_header(hash);
+  AHashSlot * table = ahash->table;
+  ArenaHashInt mask = ahash->capacity * 2 - 1;
+
+  // Put the slots of the old hash into the new table.  If the old hash is
+  // growing incrementally, some of them are still in its old table.
+  for (int t = 0; t < 2; t++)
+  {
+    const AHashSlot * old_table = t ? old_ahash->old_table : old_ahash->table;
+    if (old_table == NULL) { continue; }
+    const uint8_t * old_control = t ? _ahash_old_control(old_ahash) :
+      _ahash_control(old_ahash);
+    size_t old_slot_count = (t ? old_ahash->old_capacity : old_ahash->capacity) * 2;
+    for (size_t s = 0; s < old_slot_count; s++)
+    {
+      if (!(old_control[s] & 0x80)) { continue; }  // skip empty and deleted slots
+      ArenaHashInt slot = old_table[s].hash & mask;
+      while (table[slot].hash) { slot = (slot + 1) & mask; }
+      table[slot] = old_table[s];
+      _ahash_set_control(ahash, slot, _ahash_tag(old_table[s].hash));
+    }
   }
 
   return hash;
@@ -1491,34 +3338,65 @@ static void _ahash_resize_capacity(void ** hash, size_t capacity)
     return;
   }
 
-  *hash = _ahash_copy(*hash, capacity);
+  if ((ahash->flags & _AHASH_INCREMENTAL) && ahash->old_table == NULL)
+  {
+    // Move the slots to the new table later.
+    void * new_hash = _ahash_copy_items(*hash, capacity);
+    AHash * new_ahash = _ahash_header(new_hash);
+    new_ahash->old_table = ahash->table;
+    new_ahash->old_capacity = ahash->capacity;
+    *hash = new_hash;
+  }
+  else
+  {
+    *hash = _ahash_copy(*hash, capacity);
+  }
 
   _arena_invalidate_magic(&ahash->magic);
 }
 
+// The functions below take the key type, key size, and item size as
+// arguments even though they are stored in the header.  The generic functions
+// pass the values from the header, while the ahash_fixed_* functions pass
+// compile-time constants, so when these functions are inlined into them the
+// compiler can drop the switch statements, hash the key with a fixed-length
+// loop, and compare keys with a single instruction.
+
 // Applies the hash function to the key of the item.
-static ArenaHashInt _ahash_calculate_hash(const void * hash, const void * key)
+static _ARENA_ALWAYS_INLINE ArenaHashInt _ahash_calculate_hash_k(const AHash * ahash,
+  const void * key, AKeyType key_type, size_t key_size)
 {
-  AHash * ahash = _ahash_header(hash);
-  switch (ahash->key_type)
+  Arena * arena = ahash->arena;
+  ArenaHashFunction function = ahash->hash_function;
+  switch (key_type)
   {
   case AKEY_STRING:
-    return arena_hash_from_string(ahash->arena, *(const char **)key);
+    {
+      const char * str = *(const char **)key;
+      return arena_hash_using(arena, function, (const uint8_t *)str, strlen(str));
+    }
   case AKEY_BYTE_SLICE:
+  case _AKEY_STRING_N:
     {
       AByteSlice * bs = (AByteSlice *)key;
-      return arena_hash(ahash->arena, bs->data, bs->size);
+      return arena_hash_using(arena, function, bs->data, bs->size);
     }
   default:
-    return arena_hash(ahash->arena, (uint8_t *)key, ahash->key_size);
+    return arena_hash_using(arena, function, (const uint8_t *)key, key_size);
   }
 }
 
+static _ARENA_NOINLINE ArenaHashInt _ahash_calculate_hash(const void * hash, const void * key)
+{
+  AHash * ahash = _ahash_header(hash);
+  return _ahash_calculate_hash_k(ahash, key, ahash->key_type, ahash->key_size);
+}
+
 // Compares the keys of two items and returns true if they are equal.
-static bool _ahash_compare(const void * hash, const void * key1, const void * key2)
+static _ARENA_ALWAYS_INLINE bool _ahash_compare_k(const void * key1, const void * key2,
+  AKeyType key_type, size_t key_size)
 {
-  const AHash * ahash = _ahash_header(hash);
-  switch (ahash->key_type)
+  switch (key_type)
   {
   case AKEY_STRING:
     return !strcmp(*(const char **)key1, *(const char **)key2);
@@ -1528,66 +3406,189 @@ static bool _ahash_compare(const void * hash, const void * key1, const void * ke
       AByteSlice * bs2 = (AByteSlice *)key2;
       return bs1->size == bs2->size && !memcmp(bs1->data, bs2->data, bs1->size);
     }
+  case _AKEY_STRING_N:
+    {
+      // Don't use memcmp: the string might be shorter than the slice.
+      AByteSlice * bs = (AByteSlice *)key1;
+      const char * str = *(const char **)key2;
+      for (size_t i = 0; i < bs->size; i++)
+      {
+        if (str[i] != (char)bs->data[i] || str[i] == 0) { return false; }
+      }
+      return str[bs->size] == 0;
+    }
   default:
-    return !memcmp(key1, key2, ahash->key_size);
+    return !memcmp(key1, key2, key_size);
   }
 }
 
-// Finds the slot in the hash table where an item with the specified key is being stored
-// or could be stored.  The latter case is indicated by table[slot] == 0.
-static inline ArenaHashInt _ahash_find_slot(const void * hash, const void * key)
+// Finds the slot in the hash table where an item with the specified key and
+// hash value is being stored or could be stored.  The latter case is
+// indicated by table[slot].hash == 0.
+static _ARENA_ALWAYS_INLINE ArenaHashInt _ahash_probe_k(const void * hash,
+  const AHashSlot * table, const uint8_t * control, ArenaHashInt mask,
+  const void * key, ArenaHashInt hv, AKeyType key_type, size_t key_size,
+  size_t item_size)
 {
   const AHash * ahash = _ahash_header(hash);
-  size_t capacity = ahash->capacity;
-  ArenaHashInt * table = ahash->table;
-  ArenaHashInt hv = _ahash_calculate_hash(hash, key);
-  ArenaHashInt mask = capacity * 2 - 1;
+  uint8_t tag = _ahash_tag(hv);
   ArenaHashInt slot = hv & mask;
-  while (table[slot])
+  while (1)
   {
-    if (table[slot] == hv)
+    // Check the candidates in this group of 16 slots, up to the first empty
+    // one, which is where the linear probe sequence ends.
+    uint32_t empty = _ahash_group_empty(control + slot);
+    uint32_t match = _ahash_group_match(control + slot, tag);
+    if (empty) { match &= (empty & (0 - empty)) - 1; }
+    while (match)
     {
-      size_t found_index = table[capacity * 2 + slot];
-      assert(found_index < ahash->length);
-      void * found_item = (void *)((uint8_t *)hash + found_index * ahash->item_size);
-      if (_ahash_compare(hash, key, found_item))
+      ArenaHashInt s = (slot + __builtin_ctz(match)) & mask;
+      if (table[s].hash == hv)
       {
-        return slot;  // Found the item.  Return its slot.
+        size_t found_index = table[s].index;
+        assert(found_index < ahash->length);
+        const void * found_item = (const uint8_t *)hash + found_index * item_size;
+        if (_ahash_compare_k(key, found_item, key_type, key_size))
+        {
+          return s;  // Found the item.  Return its slot.
+        }
       }
+      match &= match - 1;
     }
-    slot = (slot + 1) & mask;
+    if (empty)
+    {
+      return (slot + __builtin_ctz(empty)) & mask;  // Item not found.
+    }
+    slot = (slot + 16) & mask;
   }
-  return slot;  // Item not found.  Return an empty slot.
 }
 
-static inline void * _ahash_find(const void * hash, const void * key)
+static _ARENA_ALWAYS_INLINE ArenaHashInt _ahash_find_slot_k(const void * hash, const void * key,
+  ArenaHashInt hv, AKeyType key_type, size_t key_size, size_t item_size)
 {
   const AHash * ahash = _ahash_header(hash);
-  size_t capacity = ahash->capacity;
-  ArenaHashInt * table = ahash->table;
-  ArenaHashInt hv = _ahash_calculate_hash(hash, key);
-  ArenaHashInt mask = capacity * 2 - 1;
-  ArenaHashInt slot = hv & mask;
-  while (table[slot])
+  return _ahash_probe_k(hash, ahash->table, _ahash_control(ahash),
+    ahash->capacity * 2 - 1, key, hv, key_type, key_size, item_size);
+}
+
+// During incremental growth, finds the slot in the old table where an item
+// with the specified key and hash value is stored.  Returns NULL if there is
+// no such item (or no old table).
+static _ARENA_ALWAYS_INLINE AHashSlot * _ahash_find_old_k(const void * hash, const void * key,
+  ArenaHashInt hv, AKeyType key_type, size_t key_size, size_t item_size)
+{
+  const AHash * ahash = _ahash_header(hash);
+  if (ahash->old_table == NULL) { return NULL; }
+  ArenaHashInt slot = _ahash_probe_k(hash, ahash->old_table,
+    _ahash_old_control(ahash), ahash->old_capacity * 2 - 1,
+    key, hv, key_type, key_size, item_size);
+  return ahash->old_table[slot].hash ? &ahash->old_table[slot] : NULL;
+}
+
+// Finds the slot where an item with the specified key and hash value is
+// stored, in either table.  Returns NULL if there is no such item.
+static _ARENA_ALWAYS_INLINE AHashSlot * _ahash_lookup_k(const void * hash, const void * key,
+  ArenaHashInt hv, AKeyType key_type, size_t key_size, size_t item_size)
+{
+  const AHash * ahash = _ahash_header(hash);
+  ArenaHashInt slot = _ahash_find_slot_k(hash, key, hv, key_type, key_size, item_size);
+  if (ahash->table[slot].hash) { return &ahash->table[slot]; }
+  return _ahash_find_old_k(hash, key, hv, key_type, key_size, item_size);
+}
+
+// Finds the slot in the hash table where an item with the specified key is being stored
+// or could be stored.  The latter case is indicated by table[slot].hash == 0.
+static _ARENA_NOINLINE ArenaHashInt _ahash_find_slot(const void * hash, const void * key)
+{
+  const AHash * ahash = _ahash_header(hash);
+  return _ahash_find_slot_k(hash, key, _ahash_calculate_hash(hash, key),
+    ahash->key_type, ahash->key_size, ahash->item_size);
+}
+
+static _ARENA_ALWAYS_INLINE void * _ahash_find_k(const void * hash, const void * key,
+  AKeyType key_type, size_t key_size, size_t item_size)
+{
+  const AHash * ahash = _ahash_header(hash);
+  ArenaHashInt hv = _ahash_calculate_hash_k(ahash, key, key_type, key_size);
+  AHashSlot * slot = _ahash_lookup_k(hash, key, hv, key_type, key_size, item_size);
+  if (slot == NULL) { return NULL; }
+  return (uint8_t *)hash + slot->index * item_size;
+}
+
+static _ARENA_NOINLINE void * _ahash_find(const void * hash, const void * key)
+{
+  const AHash * ahash = _ahash_header(hash);
+  return _ahash_find_k(hash, key, ahash->key_type, ahash->key_size,
+    ahash->item_size);
+}
+
+static inline void _ahash_find_batch_k(const void * hash, const void * keys,
+  size_t count, void ** results, AKeyType key_type, size_t key_size,
+  size_t item_size)
+{
+  const AHash * ahash = _ahash_header(hash);
+  const AHashSlot * table = ahash->table;
+  const uint8_t * control = _ahash_control(ahash);
+  ArenaHashInt mask = ahash->capacity * 2 - 1;
+  ArenaHashInt hvs[AHASH_FIND_BATCH_SIZE];
+  for (size_t start = 0; start < count; start += AHASH_FIND_BATCH_SIZE)
   {
-    if (table[slot] == hv)
+    size_t n = count - start;
+    if (n > AHASH_FIND_BATCH_SIZE) { n = AHASH_FIND_BATCH_SIZE; }
+    const uint8_t * batch_keys = (const uint8_t *)keys + start * key_size;
+
+    // Hash the keys and prefetch the control bytes and slots.
+    for (size_t i = 0; i < n; i++)
     {
-      size_t found_index = table[capacity * 2 + slot];
-      assert(found_index < ahash->length);
-      void * found_item = (void *)((uint8_t *)hash + found_index * ahash->item_size);
-      if (_ahash_compare(hash, key, found_item))
-      {
-        return found_item;
-      }
+      ArenaHashInt hv = _ahash_calculate_hash_k(ahash, batch_keys + i * key_size,
+        key_type, key_size);
+      hvs[i] = hv;
+      __builtin_prefetch(control + (hv & mask));
+      __builtin_prefetch(table + (hv & mask));
+    }
+
+    // Prefetch the first item whose tag matches each key.
+    for (size_t i = 0; i < n; i++)
+    {
+      ArenaHashInt slot = hvs[i] & mask;
+      uint32_t match = _ahash_group_match(control + slot, _ahash_tag(hvs[i]));
+      if (match == 0) { continue; }
+      slot = (slot + __builtin_ctz(match)) & mask;
+      __builtin_prefetch((const uint8_t *)hash + table[slot].index * item_size);
+    }
+
+    // Do the lookups.
+    for (size_t i = 0; i < n; i++)
+    {
+      AHashSlot * slot = _ahash_lookup_k(hash, batch_keys + i * key_size,
+        hvs[i], key_type, key_size, item_size);
+      results[start + i] = slot == NULL ? NULL :
+        (uint8_t *)hash + slot->index * item_size;
     }
-    slot = (slot + 1) & mask;
   }
-  return NULL;
+}
+
+static _ARENA_NOINLINE void _ahash_find_batch(const void * hash, const void * keys,
+  size_t count, void ** results)
+{
+  const AHash * ahash = _ahash_header(hash);
+  _ahash_find_batch_k(hash, keys, count, results, ahash->key_type,
+    ahash->key_size, ahash->item_size);
+}
+
+static inline void * _ahash_find_str_n(const void * hash, const char * str,
+  size_t length)
+{
+  const AHash * ahash = _ahash_header(hash);
+  assert(ahash->key_type == AKEY_STRING);
+  AByteSlice key = { (uint8_t *)str, length };
+  return _ahash_find_k(hash, &key, _AKEY_STRING_N, sizeof(key), ahash->item_size);
 }
 
 static void _ahash_ensure_space(void ** hash, size_t count)
 {
   AHash * ahash = _ahash_header(*hash);
+  if (ahash->old_table) { _ahash_migrate(ahash, AHASH_MIGRATION_STEP); }
   if (count <= ahash->capacity - ahash->length)
   {
     return;  // We already have enough space.
@@ -1600,117 +3601,275 @@ static void _ahash_ensure_space(void ** hash, size_t count)
   _ahash_resize_capacity(hash, ahash->length + count);
 }
 
-static inline void * _ahash_find_or_update(void ** hash, const void * item, bool * found)
+// Adds an item to the end of the array and puts it in the specified empty
+// slot of the table.  The caller must have ensured there is space for it.
+// Returns a pointer to the new item, which the caller must fill in.
+static _ARENA_ALWAYS_INLINE uint8_t * _ahash_insert(void * hash, ArenaHashInt slot,
+  ArenaHashInt hv, size_t item_size)
+{
+  AHash * ahash = _ahash_header(hash);
+  ArenaHashInt index = ahash->length++;
+  ahash->table[slot].hash = hv;
+  ahash->table[slot].index = index;
+  _ahash_set_control(ahash, slot, _ahash_tag(hv));
+  if (ahash->flags & _AHASH_ITEM_HASHES) { _ahash_item_hashes(ahash)[index] = hv; }
+  uint8_t * new_item = (uint8_t *)hash + index * item_size;
+  memset(new_item + item_size, 0, item_size);
+  return new_item;
+}
+
+static _ARENA_ALWAYS_INLINE void * _ahash_find_or_update_k(void ** hash, const void * item,
+  bool * found, AKeyType key_type, size_t key_size, size_t item_size)
 {
   _ahash_ensure_space(hash, 1);
 
   AHash * ahash = _ahash_header(*hash);
-  ArenaHashInt capacity = ahash->capacity;
-  ArenaHashInt * table = ahash->table;
-  ArenaHashInt hv = _ahash_calculate_hash(*hash, item);
-  ArenaHashInt mask = capacity * 2 - 1;
-  ArenaHashInt slot = hv & mask;
-  while (table[slot])
+  ArenaHashInt hv = _ahash_calculate_hash_k(ahash, item, key_type, key_size);
+  ArenaHashInt slot = _ahash_find_slot_k(*hash, item, hv, key_type, key_size, item_size);
+  AHashSlot * found_slot = ahash->table[slot].hash ? &ahash->table[slot] :
+    _ahash_find_old_k(*hash, item, hv, key_type, key_size, item_size);
+  if (found_slot)
   {
-    if (table[slot] == hv)
-    {
-      size_t other_index = table[capacity * 2 + slot];
-      assert(other_index < ahash->length);
-      void * other_item = (void *)((uint8_t *)*hash + other_index * ahash->item_size);
-      if (_ahash_compare(*hash, item, other_item))
-      {
-        // Found an existing item with the same key.
-        *found = true;
-        return other_item;
-      }
-    }
-    slot = (slot + 1) & mask;
+    // Found an existing item with the same key.
+    *found = true;
+    size_t other_index = found_slot->index;
+    return (uint8_t *)*hash + other_index * item_size;
   }
 
   *found = false;
-  size_t index = ahash->length++;
-  ahash->table[slot] = hv;
-  ahash->table[capacity * 2 + slot] = index;
-  uint8_t * new_item = (uint8_t *)*hash + index * ahash->item_size;
-  memcpy(new_item, item, ahash->item_size);
-  memset(new_item + ahash->item_size, 0, ahash->item_size);
+  uint8_t * new_item = _ahash_insert(*hash, slot, hv, item_size);
+  memcpy(new_item, item, item_size);
   return new_item;
 }
 
-static inline void * _ahash_update(void ** hash, const void * item)
+static _ARENA_NOINLINE void * _ahash_find_or_update(void ** hash, const void * item, bool * found)
 {
-  bool found;
-  void * stored_item = _ahash_find_or_update(hash, item, &found);
-  if (found)
+  AHash * ahash = _ahash_header(*hash);
+  return _ahash_find_or_update_k(hash, item, found, ahash->key_type,
+    ahash->key_size, ahash->item_size);
+}
+
+static inline void * _ahash_find_or_update_str_n(void ** hash, const char * str,
+  size_t length, bool * found)
+{
+  _ahash_ensure_space(hash, 1);
+
+  AHash * ahash = _ahash_header(*hash);
+  assert(ahash->key_type == AKEY_STRING);
+  assert(memchr(str, 0, length) == NULL);
+  AByteSlice key = { (uint8_t *)str, length };
+  ArenaHashInt hv = _ahash_calculate_hash_k(ahash, &key, _AKEY_STRING_N, sizeof(key));
+  ArenaHashInt slot = _ahash_find_slot_k(*hash, &key, hv, _AKEY_STRING_N,
+    sizeof(key), ahash->item_size);
+  AHashSlot * found_slot = ahash->table[slot].hash ? &ahash->table[slot] :
+    _ahash_find_old_k(*hash, &key, hv, _AKEY_STRING_N, sizeof(key), ahash->item_size);
+  if (found_slot)
   {
-    AHash * ahash = _ahash_header(*hash);
-    memcpy(stored_item, item, ahash->item_size);
+    *found = true;
+    return (uint8_t *)*hash + found_slot->index * ahash->item_size;
   }
+
+  // Only copy the string when we are adding it.
+  *found = false;
+  char * copy = (char *)arena_alloc_no_init(ahash->arena, length + 1, 1);
+  memcpy(copy, str, length);
+  copy[length] = 0;
+  uint8_t * new_item = _ahash_insert(*hash, slot, hv, ahash->item_size);
+  memset(new_item, 0, ahash->item_size);
+  memcpy(new_item, &copy, sizeof(copy));
+  return new_item;
+}
+
+static _ARENA_ALWAYS_INLINE void * _ahash_update_k(void ** hash, const void * item,
+  AKeyType key_type, size_t key_size, size_t item_size)
+{
+  bool found;
+  void * stored_item = _ahash_find_or_update_k(hash, item, &found,
+    key_type, key_size, item_size);
+  if (found) { memcpy(stored_item, item, item_size); }
   return stored_item;
 }
 
-static inline bool _ahash_delete(void * hash, const void * key)
+static _ARENA_NOINLINE void * _ahash_update(void ** hash, const void * item)
 {
-  AHash * ahash = _ahash_header(hash);
-  ArenaHashInt capacity = ahash->capacity;
-  uint32_t item_size = ahash->item_size;
-  ArenaHashInt * table = ahash->table;
-  ArenaHashInt slot = _ahash_find_slot(hash, key);
-  if (table[slot] == 0) { return 0; }
+  AHash * ahash = _ahash_header(*hash);
+  return _ahash_update_k(hash, item, ahash->key_type, ahash->key_size,
+    ahash->item_size);
+}
 
-  table[slot] = 0;
+// Finds the slot that holds the item with the specified index and hash value,
+// without comparing keys.
+static _ARENA_ALWAYS_INLINE AHashSlot * _ahash_slot_for_index(const AHash * ahash,
+  ArenaHashInt index, ArenaHashInt hv)
+{
+  AHashSlot * table = ahash->table;
+  ArenaHashInt mask = ahash->capacity * 2 - 1;
+  for (ArenaHashInt s = hv & mask; table[s].hash; s = (s + 1) & mask)
+  {
+    if (table[s].hash == hv && table[s].index == index) { return &table[s]; }
+  }
 
-  // Move the final item to take the place of the deleted item if needed.
+  // The item must still be in the old table.
+  AHashSlot * old_table = ahash->old_table;
+  const uint8_t * old_control = _ahash_old_control(ahash);
+  assert(old_table);
+  mask = ahash->old_capacity * 2 - 1;
+  for (ArenaHashInt s = hv & mask; ; s = (s + 1) & mask)
   {
-    ArenaHashInt index = table[capacity * 2 + slot];
-    ArenaHashInt final_index = ahash->length - 1;
-    if (index < final_index)
+    assert(old_control[s]);
+    if ((old_control[s] & 0x80) && old_table[s].hash == hv && old_table[s].index == index)
     {
-      void * item = (uint8_t *)hash + index * item_size;
-      void * final_item = (uint8_t *)hash + final_index * item_size;
-      memcpy(item, final_item, item_size);
-      ArenaHashInt slot2 = _ahash_find_slot(hash, item);
-      assert(table[slot2] && table[capacity * 2 + slot2] == final_index);
-      table[capacity * 2 + slot2] = index;
+      return &old_table[s];
     }
   }
+}
+
+static _ARENA_ALWAYS_INLINE bool _ahash_delete_k(void * hash, const void * key,
+  AKeyType key_type, size_t key_size, size_t item_size)
+{
+  AHash * ahash = _ahash_header(hash);
+  ArenaHashInt mask = ahash->capacity * 2 - 1;
+  AHashSlot * table = ahash->table;
+  ArenaHashInt hv = _ahash_calculate_hash_k(ahash, key, key_type, key_size);
+  ArenaHashInt slot = _ahash_find_slot_k(hash, key, hv, key_type, key_size, item_size);
+  AHashSlot * old_slot = NULL;
+  if (table[slot].hash == 0)
+  {
+    old_slot = _ahash_find_old_k(hash, key, hv, key_type, key_size, item_size);
+    if (old_slot == NULL) { return 0; }
+  }
 
+  // Move the final item to take the place of the deleted item if needed.
+  // (We have to find the final item's slot before we modify the table.)
+  ArenaHashInt index = old_slot ? old_slot->index : table[slot].index;
+  ArenaHashInt final_index = ahash->length - 1;
+  void * final_item = (uint8_t *)hash + final_index * item_size;
+  if (index < final_index)
+  {
+    void * item = (uint8_t *)hash + index * item_size;
+    ArenaHashInt final_hv;
+    if (ahash->flags & _AHASH_ITEM_HASHES)
+    {
+      ArenaHashInt * item_hashes = _ahash_item_hashes(ahash);
+      final_hv = item_hashes[index] = item_hashes[final_index];
+    }
+    else
+    {
+      final_hv = _ahash_calculate_hash_k(ahash, final_item, key_type, key_size);
+    }
+
+    _ahash_slot_for_index(ahash, final_index, final_hv)->index = index;
+    memcpy(item, final_item, item_size);
+  }
+  memset(final_item, 0, item_size);  // the new null terminator
   ahash->length--;
 
-  // In the group of non-empty slots that contains the one we just deleted,
-  // find the earliest one.
-  ArenaHashInt mask = capacity * 2 - 1;
-  size_t start = slot;
-  while (table[(start - 1) & mask])
+  if (old_slot)
   {
-    start = (start - 1) & mask;
+    // The item is in the old table.  Removing its slot would break the probe
+    // sequences there, so mark it as deleted instead.
+    _ahash_set_control_in(_ahash_old_control(ahash), ahash->old_capacity * 2,
+      old_slot - ahash->old_table, _AHASH_CONTROL_DELETED);
+    return 1;
   }
 
-  // Iterate through the table, back-shifting slots to if necessary
-  // until we find an empty one.
+  // Empty the slot, then iterate through the rest of its group of non-empty
+  // slots, back-shifting entries into the hole when that does not put them
+  // before their home slot, so that searches for them still work.
+  ArenaHashInt hole = slot;
+  table[hole].hash = 0;
+  _ahash_set_control(ahash, hole, 0);
+  for (ArenaHashInt src = (hole + 1) & mask; table[src].hash; src = (src + 1) & mask)
   {
-    size_t dest = slot;
-    size_t src = (slot + 1) & mask;
-    while (table[src])
+    ArenaHashInt home = table[src].hash & mask;
+    if (((src - home) & mask) >= ((src - hole) & mask))
     {
-      if (((table[src] - start) & mask) <= ((table[dest] - start) & mask))
-      {
-        // Move the contents of src slot to dest slot to fix searches for
-        // the item in src slot.
-        table[dest] = table[src];
-        table[capacity * 2 + dest] = table[capacity * 2 + src];
-        table[src] = 0;
-        dest = src;
-      }
-      src = (slot + 1) & mask;
+      table[hole] = table[src];
+      _ahash_set_control(ahash, hole, _ahash_tag(table[src].hash));
+      table[src].hash = 0;
+      _ahash_set_control(ahash, src, 0);
+      hole = src;
     }
   }
   return 1;
 }
 
+static _ARENA_NOINLINE bool _ahash_delete(void * hash, const void * key)
+{
+  AHash * ahash = _ahash_header(hash);
+  return _ahash_delete_k(hash, key, ahash->key_type, ahash->key_size,
+    ahash->item_size);
+}
+
+static inline void _ahash_set_hash_function(void * hash, ArenaHashFunction function)
+{
+  AHash * ahash = _ahash_header(hash);
+  if (ahash->hash_function == function) { return; }
+  ahash->hash_function = function;
+
+  // Rebuild the table with the new hash values.  This covers any items that
+  // are still in the old table.
+  ahash->old_table = NULL;
+  ahash->old_capacity = 0;
+  ahash->migrated = 0;
+  ArenaHashInt capacity = ahash->capacity;
+  ArenaHashInt mask = capacity * 2 - 1;
+  AHashSlot * table = ahash->table;
+  memset(table, 0, _ahash_table_size(capacity, ahash->flags));
+  for (ArenaHashInt index = 0; index < ahash->length; index++)
+  {
+    const void * item = (const uint8_t *)hash + index * ahash->item_size;
+    ArenaHashInt hv = _ahash_calculate_hash(hash, item);
+    ArenaHashInt slot = hv & mask;
+    while (table[slot].hash) { slot = (slot + 1) & mask; }
+    table[slot].hash = hv;
+    table[slot].index = index;
+    _ahash_set_control(ahash, slot, _ahash_tag(hv));
+    if (ahash->flags & _AHASH_ITEM_HASHES) { _ahash_item_hashes(ahash)[index] = hv; }
+  }
+}
+
+static inline void _ahash_enable_incremental_growth(void * hash)
+{
+  _ahash_header(hash)->flags |= _AHASH_INCREMENTAL;
+}
+
+static inline void _ahash_enable_fast_delete(void * hash)
+{
+  AHash * ahash = _ahash_header(hash);
+  if (ahash->flags & _AHASH_ITEM_HASHES) { return; }
+  if (ahash->old_table) { _ahash_migrate(ahash, ahash->old_capacity * 2); }
+
+  // Grow the table to hold the item hashes, and fill them in.
+  size_t old_size = _ahash_table_size(ahash->capacity, ahash->flags);
+  ahash->flags |= _AHASH_ITEM_HASHES;
+  ahash->table = (AHashSlot *)arena_realloc(ahash->arena, ahash->table,
+    old_size, _ahash_table_size(ahash->capacity, ahash->flags), alignof(AHash));
+  ArenaHashInt * item_hashes = _ahash_item_hashes(ahash);
+  for (size_t s = 0; s < ahash->capacity * 2; s++)
+  {
+    if (ahash->table[s].hash == 0) { continue; }  // skip empty slots
+    item_hashes[ahash->table[s].index] = ahash->table[s].hash;
+  }
+}
+
 #define ahash_create(arena, capacity, type, T) ((T *)_ahash_create((arena), (capacity), (type), sizeof(((T*)0)->key), sizeof(T), alignof(T)))
 #define ahash_length _ahash_length
 #define ahash_capacity _ahash_capacity
+#define ahash_set_hash_function _ahash_set_hash_function
+#define ahash_enable_fast_delete _ahash_enable_fast_delete
+#define ahash_enable_incremental_growth _ahash_enable_incremental_growth
+
+// private function: Checks that a hash used with the ahash_fixed_* functions
+// has the key and item sizes they expect.
+static inline void _ahash_check_fixed(const void * hash, size_t key_size,
+  size_t item_size)
+{
+  const AHash * ahash = _ahash_header(hash);
+  (void)ahash; (void)key_size; (void)item_size;
+  assert(ahash->key_type == AKEY_DEFAULT);
+  assert(ahash->key_size == key_size && ahash->item_size == item_size);
+}
 
 #ifdef __cplusplus
 template <typename T> static inline T * ahash_copy(const T * hash, size_t capacity)
@@ -1740,6 +3899,24 @@ template<typename T> static inline T * ahash_find_p(const T * hash,
   return (T *)_ahash_find((const void *)hash, key);
 }
 
+template<typename T> static inline void ahash_find_batch(const T * hash,
+  const decltype(((T*)0)->key) * keys, size_t count, T ** results)
+{
+  _ahash_find_batch((const void *)hash, keys, count, (void **)results);
+}
+
+template<typename T> static inline T * ahash_find_str_n(const T * hash,
+  const char * str, size_t length)
+{
+  return (T *)_ahash_find_str_n((const void *)hash, str, length);
+}
+
+template<typename T> static inline T * ahash_find_or_update_str_n(T * & hash,
+  const char * str, size_t length, bool * found)
+{
+  return (T *)_ahash_find_or_update_str_n((void **)&hash, str, length, found);
+}
+
 template<typename T> static inline T * ahash_find_or_update(T * & hash,
   const T * item, bool * found)
 {
@@ -1774,6 +3951,35 @@ template<typename T> static inline bool ahash_delete_p(T * hash,
   return _ahash_delete(hash, key);
 }
 
+template<typename T> static inline T * ahash_fixed_find(const T * hash,
+  decltype(((T*)0)->key) key)
+{
+  _ahash_check_fixed(hash, sizeof(key), sizeof(T));
+  return (T *)_ahash_find_k(hash, &key, AKEY_DEFAULT, sizeof(key), sizeof(T));
+}
+
+template<typename T> static inline T * ahash_fixed_find_or_update(T * & hash,
+  T item, bool * found)
+{
+  _ahash_check_fixed(hash, sizeof(item.key), sizeof(T));
+  return (T *)_ahash_find_or_update_k((void **)&hash, &item, found,
+    AKEY_DEFAULT, sizeof(item.key), sizeof(T));
+}
+
+template<typename T> static inline T * ahash_fixed_update(T * & hash, T item)
+{
+  _ahash_check_fixed(hash, sizeof(item.key), sizeof(T));
+  return (T *)_ahash_update_k((void **)&hash, &item,
+    AKEY_DEFAULT, sizeof(item.key), sizeof(T));
+}
+
+template<typename T> static inline bool ahash_fixed_delete(T * hash,
+  decltype(((T*)0)->key) key)
+{
+  _ahash_check_fixed(hash, sizeof(key), sizeof(T));
+  return _ahash_delete_k(hash, &key, AKEY_DEFAULT, sizeof(key), sizeof(T));
+}
+
 #else
 #define ahash_copy(hash, cap) ((typeof_unqual(*hash)*)_ahash_copy((hash), (cap)))
 #define ahash_resize_capacity(hash, c) (_ahash_resize_capacity(_ARENA_PP(&(hash)), (c)))
@@ -1781,8 +3987,319 @@ template<typename T> static inline bool ahash_delete_p(T * hash,
 #define ahash_set_length(hash, l) (_ahash_set_length(_ARENA_PP(&(hash)), (l)))
 #define ahash_find(hash, k) ((typeof(hash))_ahash_find((hash), _ARENA_T_VAL((k), typeof_unqual((hash)->key))))
 #define ahash_find_p(hash, k) ((typeof(hash))_ahash_find((hash), _ARENA_T_PTR((k), typeof_unqual((hash)->key))))
+#define ahash_find_batch(hash, keys, n, r) (_ahash_find_batch((hash), _ARENA_T_PTR((keys), typeof_unqual((hash)->key)), (n), \
+  _Generic((r), typeof_unqual(*(hash)) **: (void **)(r))))
+#define ahash_find_str_n(hash, s, n) ((typeof(hash))_ahash_find_str_n((hash), (s), (n)))
+#define ahash_find_or_update_str_n(hash, s, n, f) ((typeof(hash))_ahash_find_or_update_str_n(_ARENA_PP(&(hash)), (s), (n), (f)))
 #define ahash_find_or_update(hash, item, f) ((typeof(hash))_ahash_find_or_update(_ARENA_PP(&(hash)), _ARENA_T_PTR_OR_VAL((item), typeof(*hash)), (f)))
 #define ahash_update(hash, item) ((typeof(hash))_ahash_update(_ARENA_PP(&(hash)), _ARENA_T_PTR_OR_VAL((item), typeof(*hash))))
 #define ahash_delete(hash, k) (_ahash_delete((hash), _ARENA_T_VAL((k), typeof_unqual((hash)->key))))
-#define ahash_delete_p(hash, k) (_ahash_delete_p((hash), _ARENA_T_PTR((k), typeof_unqual((hash)->key))))
+#define ahash_delete_p(hash, k) (_ahash_delete((hash), _ARENA_T_PTR((k), typeof_unqual((hash)->key))))
+#define ahash_fixed_find(hash, k) (_ahash_check_fixed((hash), sizeof((hash)->key), sizeof(*(hash))), \
+  (typeof(hash))_ahash_find_k((hash), _ARENA_T_VAL((k), typeof_unqual((hash)->key)), \
+  AKEY_DEFAULT, sizeof((hash)->key), sizeof(*(hash))))
+#define ahash_fixed_find_or_update(hash, item, f) (_ahash_check_fixed((hash), sizeof((hash)->key), sizeof(*(hash))), \
+  (typeof(hash))_ahash_find_or_update_k(_ARENA_PP(&(hash)), _ARENA_T_VAL((item), typeof_unqual(*(hash))), (f), \
+  AKEY_DEFAULT, sizeof((hash)->key), sizeof(*(hash))))
+#define ahash_fixed_update(hash, item) (_ahash_check_fixed((hash), sizeof((hash)->key), sizeof(*(hash))), \
+  (typeof(hash))_ahash_update_k(_ARENA_PP(&(hash)), _ARENA_T_VAL((item), typeof_unqual(*(hash))), \
+  AKEY_DEFAULT, sizeof((hash)->key), sizeof(*(hash))))
+#define ahash_fixed_delete(hash, k) (_ahash_check_fixed((hash), sizeof((hash)->key), sizeof(*(hash))), \
+  _ahash_delete_k((hash), _ARENA_T_VAL((k), typeof_unqual((hash)->key)), \
+  AKEY_DEFAULT, sizeof((hash)->key), sizeof(*(hash))))
+#endif
+
+//// C++ allocators ////////////////////////////////////////////////////////////
+// These adapters let standard C++ containers allocate from an Arena:
+//
+//   std::vector<int, ArenaAllocator<int>> v(ArenaAllocator<int>(&arena));
+//
+//   ArenaResource resource(&arena);
+//   std::pmr::unordered_map<int, std::pmr::string> map(&resource);
+//
+// Deallocation only gives memory back to the arena if it was the last
+// allocation made from the arena (see arena_resize); otherwise the memory is
+// released when the arena is cleared or freed.  Objects in those containers
+// are not destroyed by the arena, so the containers must be destroyed
+// before the arena is cleared, or allocated with arena_new.
+
+#ifdef __cplusplus
+
+template <typename T> struct ArenaAllocator
+{
+  typedef T value_type;
+
+  Arena * arena;
+
+  explicit ArenaAllocator(Arena * arena) noexcept : arena(arena) { }
+
+  template <typename U> ArenaAllocator(const ArenaAllocator<U> & other) noexcept
+    : arena(other.arena) { }
+
+  T * allocate(size_t count)
+  {
+    return (T *)arena_alloc_n_no_init(arena, count, sizeof(T), alignof(T));
+  }
+
+  void deallocate(T * p, size_t count) noexcept
+  {
+    (void)count;
+    arena_resize(arena, p, 0);
+  }
+
+  template <typename U> bool operator==(const ArenaAllocator<U> & other) const noexcept
+  {
+    return arena == other.arena;
+  }
+
+  template <typename U> bool operator!=(const ArenaAllocator<U> & other) const noexcept
+  {
+    return arena != other.arena;
+  }
+};
+
+#endif
+
+#if ARENA_PMR
+
+class ArenaResource : public std::pmr::memory_resource
+{
+public:
+  explicit ArenaResource(Arena * arena) noexcept : arena(arena) { }
+
+  Arena * get_arena() const noexcept { return arena; }
+
+protected:
+  void * do_allocate(size_t size, size_t alignment) override
+  {
+    return arena_alloc_no_init(arena, size, alignment);
+  }
+
+  void do_deallocate(void * p, size_t size, size_t alignment) override
+  {
+    (void)size; (void)alignment;
+    arena_resize(arena, p, 0);
+  }
+
+  // Memory from one resource can be freed through another resource for the
+  // same arena, so they are equal.
+  bool do_is_equal(const std::pmr::memory_resource & other) const noexcept override
+  {
+    const ArenaResource * other_resource = dynamic_cast<const ArenaResource *>(&other);
+    return other_resource && other_resource->arena == arena;
+  }
+
+private:
+  Arena * arena;
+};
+
+#endif
+
+//// C++ container wrappers ////////////////////////////////////////////////////
+// ArenaList<T>, ArenaString, and ArenaHash<T> are thin C++ classes that each
+// hold a pointer to an AList, AString, or AHash, so they have the same memory
+// layout and behavior, but with member functions, iterators, and move
+// semantics.  They do not own the memory: it belongs to the arena, and the
+// objects are only valid until the arena is cleared or freed.  Copying is
+// disabled because the copies would share the same underlying container, and
+// growing one would invalidate the other.  Use copy() for a real copy, and
+// get() to pass the container to the C-style functions.
+
+#ifdef __cplusplus
+
+template <typename T> class ArenaList
+{
+  static_assert(std::is_trivially_copyable<T>::value,
+    "AList items are moved with memcpy");
+
+public:
+  ArenaList() noexcept : list(NULL) { }
+  explicit ArenaList(Arena * arena, size_t capacity = 0)
+    : list(ali_create(arena, capacity, T)) { }
+  explicit ArenaList(T * list) noexcept : list(list) { }
+  ArenaList(const ArenaList &) = delete;
+  ArenaList & operator=(const ArenaList &) = delete;
+  ArenaList(ArenaList && other) noexcept : list(other.list) { other.list = NULL; }
+  ArenaList & operator=(ArenaList && other) noexcept
+  {
+    list = other.list;
+    other.list = NULL;
+    return *this;
+  }
+
+  ArenaList copy(size_t capacity = 0) const { return ArenaList(ali_copy(list, capacity)); }
+  T * get() const noexcept { return list; }
+  T * data() const noexcept { return list; }
+  size_t size() const { return ali_length(list); }
+  size_t capacity() const { return ali_capacity(list); }
+  bool empty() const { return size() == 0; }
+
+  T * begin() const { return list; }
+  T * end() const { return list + size(); }
+  T & operator[](size_t index) const { assert(index < size()); return list[index]; }
+  T & front() const { assert(!empty()); return list[0]; }
+  T & back() const { assert(!empty()); return list[size() - 1]; }
+
+  // The item is taken by value because it might be an item of this list,
+  // which growing the list would move.
+  void push_back(T item) { *(T *)_ali_push0((void **)&list, sizeof(T)) = item; }
+
+  // The item is constructed before the list grows, since the arguments might
+  // refer to items of this list.
+  template <typename... Args> T & emplace_back(Args &&... args)
+  {
+    T item(std::forward<Args>(args)...);
+    return *new (_ali_push0((void **)&list, sizeof(T))) T(std::move(item));
+  }
+
+  void pop_back() { assert(!empty()); ali_set_length(list, size() - 1); }
+  void resize(size_t length) { ali_set_length(list, length); }
+  void reserve(size_t capacity)
+  {
+    if (capacity > this->capacity()) { ali_resize_capacity(list, capacity); }
+  }
+  void shrink_to_fit() { ali_resize_capacity(list, 0); }
+  void clear() { ali_set_length(list, 0); }
+  void drop_front(size_t count) { ali_drop(list, count); }
+
+#ifdef __cpp_lib_span
+  std::span<T> span() const { return std::span<T>(list, size()); }
+  operator std::span<T>() const { return span(); }
+#endif
+
+private:
+  T * list;
+};
+
+class ArenaString
+{
+public:
+  ArenaString() noexcept : str(NULL) { }
+  explicit ArenaString(Arena * arena) : str(astr_create(arena, 0)) { }
+  // A null cstr makes an empty string, so ArenaString(arena, 0) works.
+  ArenaString(Arena * arena, const char * cstr)
+    : str(astr_create(arena, cstr ? strlen(cstr) : 0)) { if (cstr) { astr_puts(&str, cstr); } }
+  explicit ArenaString(char * str) noexcept : str(str) { }
+  static ArenaString with_capacity(Arena * arena, size_t capacity)
+  {
+    return ArenaString(astr_create(arena, capacity));
+  }
+  ArenaString(const ArenaString &) = delete;
+  ArenaString & operator=(const ArenaString &) = delete;
+  ArenaString(ArenaString && other) noexcept : str(other.str) { other.str = NULL; }
+  ArenaString & operator=(ArenaString && other) noexcept
+  {
+    str = other.str;
+    other.str = NULL;
+    return *this;
+  }
+
+  ArenaString copy(size_t capacity = 0) const { return ArenaString(astr_copy(str, capacity)); }
+  char * get() const noexcept { return str; }
+  char * data() const noexcept { return str; }
+  const char * c_str() const noexcept { return str; }
+  size_t size() const { return astr_length(str); }
+  size_t length() const { return astr_length(str); }
+  size_t capacity() const { return astr_capacity(str); }
+  bool empty() const { return size() == 0; }
+
+  char * begin() const { return str; }
+  char * end() const { return str + size(); }
+  char & operator[](size_t index) const { assert(index < size()); return str[index]; }
+
+  ArenaString & append(const char * data, size_t size)
+  {
+    astr_write_at_offset(&str, astr_length(str), size, data);
+    return *this;
+  }
+  ArenaString & append(const char * cstr) { astr_puts(&str, cstr); return *this; }
+  ArenaString & operator+=(const char * cstr) { return append(cstr); }
+  ArenaString & operator+=(char c) { return append(&c, 1); }
+
+  int printf(const char * format, ...) __attribute__((format(printf, 2, 3)))
+  {
+    va_list ap;
+    va_start(ap, format);
+    int result = astr_vprintf(&str, format, ap);
+    va_end(ap);
+    return result;
+  }
+
+  void resize(size_t length) { astr_set_length(&str, length); }
+  void reserve(size_t capacity)
+  {
+    if (capacity > this->capacity()) { astr_resize_capacity(&str, capacity); }
+  }
+  void shrink_to_fit() { astr_resize_capacity(&str, 0); }
+  void clear() { astr_clear(&str); }
+
+#ifdef __cpp_lib_string_view
+  ArenaString(Arena * arena, std::string_view sv)
+    : str(astr_create(arena, sv.size())) { append(sv.data(), sv.size()); }
+  ArenaString & append(std::string_view sv) { return append(sv.data(), sv.size()); }
+  ArenaString & operator+=(std::string_view sv) { return append(sv); }
+  std::string_view view() const { return std::string_view(str, size()); }
+  operator std::string_view() const { return view(); }
+#endif
+
+#ifdef __cpp_lib_span
+  std::span<char> span() const { return std::span<char>(str, size()); }
+#endif
+
+private:
+  char * str;
+};
+
+template <typename T> class ArenaHash
+{
+  static_assert(std::is_trivially_copyable<T>::value,
+    "AHash items are moved with memcpy");
+
+public:
+  typedef decltype(((T*)0)->key) key_type;
+
+  ArenaHash() noexcept : hash(NULL) { }
+  explicit ArenaHash(Arena * arena, AKeyType type = AKEY_DEFAULT, size_t capacity = 0)
+    : hash(ahash_create(arena, capacity, type, T)) { }
+  explicit ArenaHash(T * hash) noexcept : hash(hash) { }
+  ArenaHash(const ArenaHash &) = delete;
+  ArenaHash & operator=(const ArenaHash &) = delete;
+  ArenaHash(ArenaHash && other) noexcept : hash(other.hash) { other.hash = NULL; }
+  ArenaHash & operator=(ArenaHash && other) noexcept
+  {
+    hash = other.hash;
+    other.hash = NULL;
+    return *this;
+  }
+
+  ArenaHash copy(size_t capacity = 0) const { return ArenaHash(ahash_copy(hash, capacity)); }
+  T * get() const noexcept { return hash; }
+  T * data() const noexcept { return hash; }
+  size_t size() const { return ahash_length(hash); }
+  size_t capacity() const { return ahash_capacity(hash); }
+  bool empty() const { return size() == 0; }
+
+  // Items are stored in an array in the order they were added (except that
+  // deleting an item moves the last item into its place).
+  T * begin() const { return hash; }
+  T * end() const { return hash + size(); }
+
+  T * find(const key_type & key) const { return ahash_find_p(hash, &key); }
+  bool contains(const key_type & key) const { return find(key) != NULL; }
+  T * find_or_update(const T & item, bool * found)
+  {
+    return ahash_find_or_update(hash, &item, found);
+  }
+  T * update(const T & item) { return ahash_update(hash, &item); }
+  bool erase(const key_type & key) { return ahash_delete_p(hash, &key); }
+  void reserve(size_t capacity) { ahash_resize_capacity(hash, capacity); }
+
+#ifdef __cpp_lib_span
+  std::span<T> span() const { return std::span<T>(hash, size()); }
+#endif
+
+private:
+  T * hash;
+};
+
 #endif
@@ -7,6 +7,13 @@
 #include <time.h>
 #include <ctype.h>
 
+#ifdef __cplusplus
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+#endif
+
 typedef struct AllocRequest {
   size_t size;
   size_t alignment;
@@ -72,10 +79,10 @@ void hexdump_ahash(void * hash)
 
   for (ArenaHashInt slot = 0; slot < ahash->capacity * 2; slot++)
   {
-    if (ahash->table[slot])
+    if (ahash->table[slot].hash)
     {
       printf("  slot %u: hash %u -> index %u\n", slot,
-        ahash->table[slot], ahash->table[slot + ahash->capacity * 2]);
+        ahash->table[slot].hash, ahash->table[slot].index);
     }
     else
     {
@@ -145,6 +152,695 @@ void test_arena_randomly()
   arena_free(&arena);
 }
 
+void test_arena_concurrent()
+{
+  ArenaConcurrent carena = {};
+  assert(arena_concurrent_memory_size(&carena) == 0);
+
+  uint8_t * last_alloc = NULL;
+  for (size_t i = 0; i < 100; i++)
+  {
+    size_t alignment = (size_t)1 << (i & 3);
+    uint8_t * alloc = (uint8_t *)arena_concurrent_alloc(&carena, 10, alignment);
+    assert(((uintptr_t)alloc & (alignment - 1)) == 0);
+    assert(alloc[0] == 0 && alloc[9] == 0);
+    memset(alloc, 0xAA, 10);
+    assert(alloc != last_alloc);
+    last_alloc = alloc;
+  }
+  assert(carena.block->header.prev != NULL);
+  assert(arena_concurrent_memory_size(&carena) >= 1000);
+
+  arena_concurrent_free(&carena);
+  assert(carena.block == NULL);
+}
+
+#ifdef __cplusplus
+typedef struct ConcurrentAlloc {
+  uint8_t * data;
+  size_t size;
+  uint8_t stamp;
+} ConcurrentAlloc;
+
+// Several threads allocate from the same concurrent arena at once, across
+// many block boundaries.  Each thread fills its allocations with a stamp, and
+// at the end we check that the allocations don't overlap and that every
+// stamp is intact.
+void test_arena_concurrent_threads()
+{
+  ArenaConcurrent carena = {};
+  const size_t thread_count = 8;
+  const size_t alloc_count = 5000;
+  std::vector<std::vector<ConcurrentAlloc>> allocs(thread_count);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < thread_count; t++)
+  {
+    threads.emplace_back([&carena, &allocs, t, alloc_count]() {
+      for (size_t i = 0; i < alloc_count; i++)
+      {
+        size_t size = 1 + (i * 37 + t * 11) % 700;
+        size_t alignment = (size_t)1 << ((i + t) % 5);
+        uint8_t * data = (uint8_t *)arena_concurrent_alloc(&carena, size, alignment);
+        assert(((uintptr_t)data & (alignment - 1)) == 0);
+        assert(data[0] == 0 && data[size - 1] == 0);
+        uint8_t stamp = (uint8_t)(t * 31 + i);
+        memset(data, stamp, size);
+        allocs[t].push_back({ data, size, stamp });
+      }
+    });
+  }
+  for (std::thread & thread : threads) { thread.join(); }
+
+  std::vector<ConcurrentAlloc> all;
+  for (const std::vector<ConcurrentAlloc> & list : allocs)
+  {
+    all.insert(all.end(), list.begin(), list.end());
+  }
+  assert(all.size() == thread_count * alloc_count);
+  std::sort(all.begin(), all.end(),
+    [](const ConcurrentAlloc & a, const ConcurrentAlloc & b) { return a.data < b.data; });
+  for (size_t i = 0; i < all.size(); i++)
+  {
+    if (i > 0) { assert(all[i - 1].data + all[i - 1].size <= all[i].data); }
+    for (size_t j = 0; j < all[i].size; j++) { assert(all[i].data[j] == all[i].stamp); }
+  }
+
+  arena_concurrent_free(&carena);
+}
+#endif
+
+void test_arena_virtual()
+{
+#if ARENA_MMAP
+  Arena varena = {};
+  arena_init_virtual(&varena, (size_t)1 << 30);
+  size_t initial_size = arena_memory_size(&varena);
+  assert(initial_size >= ARENA_FIRST_BLOCK_SIZE);
+
+  // An AList allocated last grows in place instead of moving.
+  int * list = ali_create(&varena, 1, int);
+  int * original_list = list;
+  for (int i = 0; i < 100000; i++) { ali_push(list, i); }
+  assert(list == original_list);
+  assert(list[99999] == 99999 && list[100000] == 0);
+  assert(arena_memory_size(&varena) > 400000);
+  assert(varena.block->prev == NULL);
+
+  arena_clear(&varena);
+  char * str = arena_printf(&varena, "%d", 1234);
+  assert(strcmp(str, "1234") == 0);
+
+  arena_free(&varena);
+  assert(varena.block == NULL && varena.reserve_end == 0);
+#endif
+}
+
+size_t test_block_count;
+
+void * test_block_alloc(void * data, size_t size, bool * zeroed)
+{
+  assert(data == &test_block_count);
+  test_block_count++;
+  *zeroed = false;
+  return malloc(size);
+}
+
+void test_block_free(void * data, void * block, size_t size)
+{
+  assert(data == &test_block_count);
+  assert(size >= ARENA_FIRST_BLOCK_SIZE);
+  test_block_count--;
+  free(block);
+}
+
+void test_arena_block_allocators()
+{
+  Arena barena = {};
+  barena.block_alloc_callback = test_block_alloc;
+  barena.block_free_callback = test_block_free;
+  barena.block_callback_data = &test_block_count;
+  arena_alloc(&barena, 100, 1);
+  arena_alloc(&barena, 100, 1);
+  assert(test_block_count == 2);
+  arena_clear(&barena);
+  assert(test_block_count == 1);
+  arena_free(&barena);
+  assert(test_block_count == 0);
+
+  barena.block_alloc_callback = arena_block_alloc_aligned;
+  barena.block_free_callback = arena_block_free_malloc;
+  void * p = arena_alloc(&barena, 100, 1);
+  assert(((uintptr_t)barena.block % ARENA_ALIGNED_BLOCK_ALIGNMENT) == 0);
+  assert(p);
+  arena_free(&barena);
+
+  // Blocks freed by one arena are reused by the next one.
+  barena.block_alloc_callback = arena_block_alloc_pooled;
+  barena.block_free_callback = arena_block_free_pooled;
+  arena_alloc(&barena, 100, 1);
+  ArenaBlockHeader * pooled_block = barena.block;
+  arena_free(&barena);
+  Arena barena2 = barena;
+  arena_alloc(&barena2, 100, 1);
+  assert(barena2.block == pooled_block);
+  arena_free(&barena2);
+  arena_block_pool_trim();
+  assert(arena_block_pool_local.counts[7] == 0);
+
+#if ARENA_MMAP
+  barena.block_alloc_callback = arena_block_alloc_mmap;
+  barena.block_free_callback = arena_block_free_mmap;
+  for (size_t i = 0; i < 10; i++) { memset(arena_alloc(&barena, 1000, 8), 1, 1000); }
+  arena_free(&barena);
+
+  ArenaHugePageOptions huge_options = { 4096, false };
+  barena.block_alloc_callback = arena_block_alloc_huge;
+  barena.block_free_callback = arena_block_free_huge;
+  barena.block_callback_data = &huge_options;
+  for (size_t i = 0; i < 10; i++) { memset(arena_alloc(&barena, 1000, 8), 1, 1000); }
+  assert(barena.block->size >= 4096);
+  assert(((uintptr_t)barena.block % ARENA_HUGE_PAGE_SIZE) == 0);
+  arena_free(&barena);
+#endif
+}
+
+void test_arena_rewind()
+{
+  Arena rarena = {};
+
+  // Rewinding to a mark from an empty arena acts like arena_clear.
+  ArenaMark mark0 = arena_mark(&rarena);
+  arena_alloc(&rarena, 100, 1);
+  arena_alloc(&rarena, 100, 1);
+  arena_rewind(&rarena, mark0);
+  assert(rarena.block && rarena.block->prev == NULL);
+  assert(rarena.size_estimate == 0);
+  assert(rarena.size_estimate_high >= 200);
+
+  uint8_t * p1 = (uint8_t *)arena_alloc(&rarena, 10, 1);
+  size_t size1 = arena_memory_size(&rarena);
+  ArenaMark mark1 = arena_mark(&rarena);
+  uint8_t * p2 = (uint8_t *)arena_alloc(&rarena, 10, 1);
+  for (size_t i = 0; i < 20; i++) { arena_alloc(&rarena, 1000, 8); }
+  assert(arena_memory_size(&rarena) > size1);
+
+  arena_rewind(&rarena, mark1);
+  assert(arena_memory_size(&rarena) == size1);
+  assert(arena_alloc(&rarena, 10, 1) == p2);
+  assert(p1 + 10 == p2);
+
+  arena_free(&rarena);
+}
+
+void test_arena_large_allocation()
+{
+  Arena larena = {};
+  uint8_t * p1 = (uint8_t *)arena_alloc(&larena, 8, 1);
+  ArenaBlockHeader * block = larena.block;
+  ArenaMark mark = arena_mark(&larena);
+  size_t size1 = arena_memory_size(&larena);
+
+  // A large allocation gets its own block behind the current block.
+  uint8_t * large = (uint8_t *)arena_alloc(&larena, ARENA_LARGE_ALLOCATION_SIZE, 64);
+  assert(((uintptr_t)large & 63) == 0);
+  memset(large, 1, ARENA_LARGE_ALLOCATION_SIZE);
+  assert(larena.block == block);
+  assert(larena.block->prev && larena.block->prev->prev == NULL);
+  assert(arena_memory_size(&larena) >= size1 + ARENA_LARGE_ALLOCATION_SIZE);
+  assert(larena.size_estimate >= ARENA_LARGE_ALLOCATION_SIZE);
+
+  // Small allocations keep using the current block.
+  uint8_t * p2 = (uint8_t *)arena_alloc(&larena, 8, 1);
+  assert(p2 == p1 + 8);
+
+  arena_rewind(&larena, mark);
+  assert(larena.block == block && larena.block->prev == NULL);
+  assert(arena_memory_size(&larena) == size1);
+
+  arena_free(&larena);
+}
+
+void test_arena_tails()
+{
+  Arena tarena = {};
+  arena_start_new_block(&tarena, 256);
+  uint8_t * p1 = (uint8_t *)arena_alloc(&tarena, 16, 1);
+  arena_start_new_block(&tarena, 128);
+  assert(tarena.tails[0].start == (uintptr_t)(p1 + 16));
+  ArenaBlockHeader * block = tarena.block;
+
+  // When the current block is full, small allocations come from the tail of
+  // the previous block.
+  arena_alloc(&tarena, 128, 1);
+  uint8_t * p2 = (uint8_t *)arena_alloc(&tarena, 32, 1);
+  assert(p2 == p1 + 16);
+  assert(tarena.block == block);
+  assert(tarena.tails[0].start == (uintptr_t)(p2 + 32));
+
+  arena_clear(&tarena);
+  assert(tarena.tails[0].start == 0);
+  arena_free(&tarena);
+}
+
+void test_arena_stats()
+{
+#if ARENA_STATS
+  Arena sarena = {};
+  arena_alloc(&sarena, 1, 1);
+  arena_alloc(&sarena, 4, 4);
+  void * p = arena_alloc(&sarena, 8, 1);
+  arena_resize(&sarena, p, 4);
+  ArenaStats stats = arena_stats(&sarena);
+  assert(stats.allocation_count == 3);
+  assert(stats.bytes_requested == 9);
+  assert(stats.alignment_padding == 3);
+  assert(stats.resize_count == 1);
+  assert(stats.block_count == 1);
+  assert(stats.block_bytes == arena_memory_size(&sarena));
+
+  for (size_t i = 0; i < 10; i++) { arena_alloc(&sarena, 100, 8); }
+  stats = arena_stats(&sarena);
+  assert(stats.block_count > 1);
+  assert(stats.block_bytes == arena_memory_size(&sarena));
+  assert(stats.abandoned_bytes > 0);
+
+  // Large allocations count their alignment padding too.
+  size_t padding = stats.alignment_padding;
+  uint8_t * large = (uint8_t *)arena_alloc(&sarena, ARENA_LARGE_ALLOCATION_SIZE, 256);
+  stats = arena_stats(&sarena);
+  assert(stats.large_allocation_count == 1);
+  uint8_t * large_start = (uint8_t *)sarena.block->prev + arena_block_overhead;
+  assert(stats.alignment_padding == padding + (size_t)(large - large_start));
+
+  arena_clear(&sarena);
+  stats = arena_stats(&sarena);
+  assert(stats.clear_count == 1);
+  assert(stats.block_count == 1);
+  assert(stats.block_bytes == arena_memory_size(&sarena));
+
+  arena_free(&sarena);
+  stats = arena_stats(&sarena);
+  assert(stats.block_count == 0 && stats.block_bytes == 0);
+#endif
+}
+
+void test_arena_decay()
+{
+  Arena darena = {};
+  darena.size_estimate_decay = 1;
+  darena.trim_on_clear = true;
+  uint8_t * big = (uint8_t *)arena_alloc(&darena, 100000, 1);
+  memset(big, 0xFF, 100000);
+  arena_clear(&darena);
+  size_t high = darena.size_estimate_high;
+  assert(high >= 100000);
+
+  // With no demand, the estimate halves on each clear.
+  arena_clear(&darena);
+  assert(darena.size_estimate_high < high);
+  for (size_t i = 0; i < 20; i++) { arena_clear(&darena); }
+  assert(darena.size_estimate_high < 100);
+
+  // Demand in the current cycle stops the decay.
+  arena_alloc(&darena, 50000, 1);
+  arena_clear(&darena);
+  assert(darena.size_estimate_high >= 50000);
+
+#if ARENA_MMAP && defined(__linux__)
+  // The trimmed pages at the end of the block read back as zero.
+  assert(big[99999] == 0);
+#endif
+
+  // A decay too large to shift by does nothing.
+  darena.size_estimate_decay = 255;
+  high = darena.size_estimate_high;
+  arena_clear(&darena);
+  assert(darena.size_estimate_high == high);
+
+  arena_free(&darena);
+}
+
+#if ARENA_MMAP
+// Allocates blocks with mmap, but does not report them as zeroed, like an
+// allocator that returns shared or file-backed memory would.
+void * test_block_alloc_unknown(void * data, size_t size, bool * zeroed)
+{
+  void * block = arena_block_alloc_mmap(data, size, zeroed);
+  *zeroed = false;
+  return block;
+}
+#endif
+
+void test_arena_trim_unknown_memory()
+{
+#if ARENA_MMAP
+  // Trimming still discards pages, but the arena does not assume they read
+  // as zero afterwards unless the allocator said the block was zeroed.
+  Arena darena = {};
+  darena.size_estimate_decay = 1;
+  darena.trim_on_clear = true;
+  darena.block_alloc_callback = test_block_alloc_unknown;
+  darena.block_free_callback = arena_block_free_mmap;
+  arena_alloc(&darena, 100000, 1);
+  arena_clear(&darena);
+  for (size_t i = 0; i < 20; i++) { arena_clear(&darena); }
+  assert(darena.size_estimate_high < 100);
+  assert(!darena.block_discard_zeroes);
+  assert(darena.block_dirty_end == darena.block_end);
+  arena_free(&darena);
+#endif
+}
+
+void test_arena_zero_tracking()
+{
+  // Fresh pages from calloc are not cleared again, and memory that has been
+  // handed out and given back is.
+  Arena zarena = {};
+  zarena.size_estimate_high = ARENA_CALLOC_MIN_SIZE;
+  uint8_t * p = (uint8_t *)arena_alloc(&zarena, 64, 1);
+  assert(zarena.block_dirty_end < zarena.block_end);
+  for (size_t i = 0; i < 64; i++) { assert(p[i] == 0); }
+  memset(p, 0xFF, 64);
+  assert(arena_resize(&zarena, p, 16));
+  uint8_t * q = (uint8_t *)arena_alloc(&zarena, 64, 1);
+  for (size_t i = 0; i < 64; i++) { assert(q[i] == 0); }
+
+  int * list = ali_create(&zarena, 4, int);
+  for (int i = 0; i < 1000; i++) { ali_push(list, i); }
+  ali_set_length(list, 10);
+  memset(list + 10, 0xFF, sizeof(int) * 8);
+  ali_set_length(list, 2000);
+  for (size_t i = 10; i <= 2000; i++) { assert(list[i] == 0); }
+
+  char * str = astr_create(&zarena, 4);
+  for (int i = 0; i < 1000; i++) { astr_puts(&str, "ab"); }
+  astr_set_length(&str, 3);
+  astr_set_length(&str, 3000);
+  for (size_t i = 3; i <= 3000; i++) { assert(str[i] == 0); }
+
+  arena_clear(&zarena);
+  p = (uint8_t *)arena_alloc(&zarena, 64, 1);
+  for (size_t i = 0; i < 64; i++) { assert(p[i] == 0); }
+  arena_free(&zarena);
+}
+
+void test_arena_alloc_array()
+{
+  Arena aarena = {};
+  Foo * foos = arena_alloc_array(&aarena, 100, Foo);
+  for (size_t i = 0; i < 100; i++) { assert(foos[i].a == 0 && foos[i].b == 0); }
+  assert((uintptr_t)foos % alignof(Foo) == 0);
+
+  // Sizes that are not a multiple of the alignment are padded.
+  void * objects[50];
+  arena_alloc_many(&aarena, objects, 50, 5, 4);
+  for (size_t i = 0; i < 50; i++)
+  {
+    assert((uintptr_t)objects[i] % 4 == 0);
+    if (i) { assert((uint8_t *)objects[i] - (uint8_t *)objects[i - 1] == 8); }
+    for (size_t j = 0; j < 5; j++) { assert(((uint8_t *)objects[i])[j] == 0); }
+  }
+  arena_alloc_many_no_init(&aarena, objects, 3, 16, 16);
+  assert((uint8_t *)objects[2] - (uint8_t *)objects[0] == 32);
+
+  arena_free(&aarena);
+}
+
+alignas(16) uint8_t test_bump_buffer[16384];
+size_t test_bump_used;
+
+void * test_bump_block_alloc(void * data, size_t size, bool * zeroed)
+{
+  (void)data;
+  *zeroed = false;
+  if (size > sizeof(test_bump_buffer) - test_bump_used) { return NULL; }
+  test_bump_used += size;
+  return test_bump_buffer + test_bump_used - size;
+}
+
+void test_bump_block_free(void * data, void * block, size_t size)
+{
+  (void)data; (void)block; (void)size;
+}
+
+bool test_bump_block_grow(void * data, void * block, size_t old_size,
+  size_t new_size, bool * zeroed)
+{
+  (void)data;
+  *zeroed = false;
+  if ((uint8_t *)block + old_size != test_bump_buffer + test_bump_used) { return false; }
+  if (new_size - old_size > sizeof(test_bump_buffer) - test_bump_used) { return false; }
+  test_bump_used += new_size - old_size;
+  return true;
+}
+
+void test_arena_realloc()
+{
+  Arena rarena = {};
+  uint8_t * p = (uint8_t *)arena_realloc(&rarena, NULL, 0, 8, 1);
+  memset(p, 1, 8);
+
+  // The last allocation grows in place.
+  uint8_t * q = (uint8_t *)arena_realloc(&rarena, p, 8, 16, 1);
+  assert(q == p);
+  memset(q + 8, 2, 8);
+
+  // Other allocations are copied.
+  arena_alloc(&rarena, 1, 1);
+  uint8_t * r = (uint8_t *)arena_realloc(&rarena, q, 16, 1000, 8);
+  assert(r != q && (uintptr_t)r % 8 == 0);
+  for (size_t i = 0; i < 16; i++) { assert(r[i] == (i < 8 ? 1 : 2)); }
+
+  // Shrinking never moves anything.
+  assert(arena_realloc(&rarena, q, 16, 4, 1) == q);
+  arena_free(&rarena);
+
+  // A block allocator that carves blocks out of a buffer can grow the
+  // newest block in place.
+  Arena garena = {};
+  garena.block_alloc_callback = test_bump_block_alloc;
+  garena.block_free_callback = test_bump_block_free;
+  garena.block_grow_callback = test_bump_block_grow;
+  test_bump_used = 0;
+  uint8_t * g = (uint8_t *)arena_alloc(&garena, 8, 1);
+  memset(g, 3, 8);
+  for (size_t size = 16; size <= 4096; size *= 2)
+  {
+    uint8_t * g2 = (uint8_t *)arena_realloc(&garena, g, size / 2, size, 1);
+    assert(g2 == g);
+    for (size_t i = 0; i < size / 2; i++) { assert(g[i] == 3); }
+    memset(g, 3, size);
+  }
+  assert(garena.block->prev == NULL);
+  assert(arena_memory_size(&garena) == garena.block->size);
+  arena_free(&garena);
+}
+
+void test_arena_scratch()
+{
+  ArenaScratch s1 = arena_scratch_begin(&arena);
+  assert(s1.arena != &arena);
+  char * str = astr_create(s1.arena, 0);
+  astr_puts(&str, "hello");
+
+  // A nested scratch arena that must not conflict with the first one.
+  ArenaScratch s2 = arena_scratch_begin(&arena, s1.arena);
+  assert(s2.arena != &arena && s2.arena != s1.arena);
+  arena_alloc(s2.arena, 1000, 1);
+  arena_scratch_end(s2);
+
+  // The first scratch arena was not disturbed, so the string can still grow
+  // in place.
+  char * old_str = str;
+  astr_puts(&str, "!");
+  assert(str == old_str);
+  assert(strcmp(str, "hello!") == 0);
+  arena_scratch_end(s1);
+
+  ArenaScratch s3 = arena_scratch_begin(s1.arena);
+  assert(s3.arena == s2.arena);
+  arena_scratch_end(s3);
+  arena_scratch_free();
+}
+
+int test_defer_log[8];
+size_t test_defer_count;
+
+void test_defer_callback(void * context)
+{
+  test_defer_log[test_defer_count++] = *(int *)context;
+}
+
+#ifdef __cplusplus
+struct TestDeferObject
+{
+  int id;
+  TestDeferObject(int id) : id(id) { }
+  ~TestDeferObject() { test_defer_log[test_defer_count++] = id; }
+};
+#endif
+
+void test_arena_defer()
+{
+  Arena farena = {};
+  int * ids = arena_alloc_array(&farena, 4, int);
+  for (int i = 0; i < 4; i++) { ids[i] = i + 1; }
+
+  // Callbacks run in LIFO order on clear.
+  arena_defer(&farena, test_defer_callback, &ids[0]);
+  arena_defer(&farena, test_defer_callback, &ids[1]);
+  arena_clear(&farena);
+  assert(test_defer_count == 2);
+  assert(test_defer_log[0] == 2 && test_defer_log[1] == 1);
+
+  // Rewinding only runs the callbacks registered after the mark.
+  test_defer_count = 0;
+  ids = arena_alloc_array(&farena, 4, int);
+  for (int i = 0; i < 4; i++) { ids[i] = i + 1; }
+  arena_defer(&farena, test_defer_callback, &ids[0]);
+  ArenaMark mark = arena_mark(&farena);
+  arena_defer(&farena, test_defer_callback, &ids[2]);
+  arena_rewind(&farena, mark);
+  assert(test_defer_count == 1 && test_defer_log[0] == 3);
+
+#ifdef __cplusplus
+  TestDeferObject * object = arena_new<TestDeferObject>(&farena, 7);
+  assert(object->id == 7);
+  int * plain = arena_new<int>(&farena, 5);
+  assert(*plain == 5);
+#endif
+
+  arena_free(&farena);
+#ifdef __cplusplus
+  assert(test_defer_count == 3 && test_defer_log[1] == 7 && test_defer_log[2] == 1);
+#else
+  assert(test_defer_count == 2 && test_defer_log[1] == 1);
+#endif
+  assert(farena.deferred == NULL);
+}
+
+void test_arena_cpp_allocators()
+{
+#ifdef __cplusplus
+  Arena carena = {};
+  {
+    std::vector<int, ArenaAllocator<int>> v{ArenaAllocator<int>(&carena)};
+    for (int i = 0; i < 1000; i++) { v.push_back(i); }
+    assert(v[999] == 999);
+    assert(arena_memory_size(&carena) >= 1000 * sizeof(int));
+
+    // After deallocating the last allocation, the same memory is reused.
+    ArenaAllocator<double> a(v.get_allocator());
+    double * d = a.allocate(4);
+    a.deallocate(d, 4);
+    assert(a.allocate(4) == d);
+    assert(a == v.get_allocator());
+  }
+
+#if ARENA_PMR
+  {
+    ArenaResource resource(&carena);
+    assert(resource.get_arena() == &carena);
+    std::pmr::vector<std::pmr::string> strings(&resource);
+    for (int i = 0; i < 100; i++)
+    {
+      strings.emplace_back("a string too long for the small string optimization");
+    }
+    assert(strings[99][0] == 'a');
+    ArenaResource same(&carena);
+    assert(resource.is_equal(resource) && resource.is_equal(same));
+    Arena other_arena = {};
+    ArenaResource other(&other_arena);
+    assert(!resource.is_equal(other));
+    assert(!resource.is_equal(*std::pmr::new_delete_resource()));
+  }
+#endif
+
+  arena_free(&carena);
+#endif
+}
+
+#ifdef __cplusplus
+struct TestWrapperItem
+{
+  int key;
+  int value;
+  TestWrapperItem() = default;
+  TestWrapperItem(int key, int value) : key(key), value(value) { }
+};
+#endif
+
+void test_arena_cpp_wrappers()
+{
+#ifdef __cplusplus
+  Arena warena = {};
+
+  ArenaList<TestWrapperItem> list(&warena);
+  for (int i = 0; i < 100; i++) { list.emplace_back(i, i * 2); }
+  list.push_back(TestWrapperItem(100, 200));
+  assert(list.size() == 101 && list.back().value == 200);
+  int sum = 0;
+  for (const TestWrapperItem & item : list) { sum += item.key; }
+  assert(sum == 5050);
+  assert(list.get()[101].key == 0);  // still null-terminated
+  ArenaList<TestWrapperItem> moved = std::move(list);
+  assert(list.get() == NULL && moved.size() == 101);
+  moved.pop_back();
+  assert(moved.size() == 100 && moved[99].key == 99);
+
+  // Pushing an item of the list itself must work even when the list has to
+  // be copied to grow.
+  ArenaList<TestWrapperItem> alias(&warena, 1);
+  alias.push_back(TestWrapperItem(7, 14));
+  for (int i = 0; i < 2; i++)
+  {
+    TestWrapperItem * old_items = alias.get();
+    arena_alloc(&warena, 1, 1);  // keeps the list from growing in place
+    if (i == 0) { alias.push_back(alias.front()); }
+    else { alias.emplace_back(alias.front()); }
+    assert(alias.get() != old_items);
+    assert(alias.size() == (size_t)i + 2);
+    assert(alias.back().key == 7 && alias.back().value == 14);
+    alias.shrink_to_fit();
+  }
+
+  ArenaString str(&warena, "hello");
+  str += ',';
+  str += " world";
+  str.printf(" %d", 42);
+  assert(strcmp(str.c_str(), "hello, world 42") == 0);
+  assert(str.size() == 15);
+  ArenaString empty(&warena, 0);
+  ArenaString empty2(&warena, NULL);
+  ArenaString empty3(&warena);
+  assert(empty.size() == 0 && empty2.size() == 0 && empty3.size() == 0);
+  assert(strcmp(empty.c_str(), "") == 0);
+  ArenaString big = ArenaString::with_capacity(&warena, 100);
+  assert(big.size() == 0 && big.capacity() >= 100);
+#ifdef __cpp_lib_string_view
+  std::string_view sv = str;
+  assert(sv == "hello, world 42");
+  ArenaString str2(&warena, sv.substr(0, 5));
+  assert(str2.view() == "hello");
+#endif
+
+  ArenaHash<TestWrapperItem> hash(&warena);
+  for (int i = 0; i < 50; i++) { hash.update(TestWrapperItem(i, -i)); }
+  assert(hash.size() == 50 && hash.contains(7) && hash.find(7)->value == -7);
+  assert(hash.erase(7) && !hash.contains(7));
+  sum = 0;
+  for (const TestWrapperItem & item : hash) { sum += item.value; }
+  assert(sum == -(49 * 50 / 2 - 7));
+
+#ifdef __cpp_lib_span
+  std::span<TestWrapperItem> span = moved;
+  assert(span.size() == 100);
+#endif
+
+  arena_free(&warena);
+#endif
+}
+
 void test_arena_printf()
 {
   char * hi = arena_printf(&arena, "hi!!!!!!!!");
@@ -637,6 +1333,360 @@ void test_ahash_growth()
   assert(ahash_capacity(hash) == 32);
 }
 
+void test_ahash_delete_many()
+{
+  // Deleting items must keep every other item findable, no matter how the
+  // probe sequences overlap.
+  StringPair * hash = ahash_create(&arena, 0, AKEY_DEFAULT, StringPair);
+  for (size_t i = 0; i < 1000; i++)
+  {
+    ahash_update(hash, ((StringPair){ i, i * 10 }));
+  }
+  for (size_t i = 0; i < 1000; i += 3)
+  {
+    assert(ahash_delete(hash, i));
+    assert(!ahash_delete(hash, i));
+  }
+  assert(ahash_length(hash) == 666);
+  assert(hash[666].key == 0 && hash[666].value == 0);
+  for (size_t i = 0; i < 1000; i++)
+  {
+    StringPair * p = ahash_find(hash, i);
+    if (i % 3 == 0) { assert(p == NULL); }
+    else { assert(p && p->value == i * 10); }
+  }
+}
+
+typedef struct IdItem {
+  uint32_t key;
+  uint32_t value;
+} IdItem;
+
+void test_ahash_fixed()
+{
+  IdItem * hash = ahash_create(&arena, 0, AKEY_DEFAULT, IdItem);
+  for (uint32_t i = 1; i <= 500; i++)
+  {
+    IdItem item = { i, i * 3 };
+    if (i % 2) { ahash_fixed_update(hash, item); }
+    else { ahash_update(hash, item); }
+  }
+  assert(ahash_length(hash) == 500);
+  for (uint32_t i = 1; i <= 500; i++)
+  {
+    // The fixed and generic functions must agree.
+    IdItem * p = ahash_fixed_find(hash, i);
+    assert(p && p->value == i * 3);
+    assert(ahash_find(hash, i) == p);
+  }
+  assert(ahash_fixed_find(hash, 501) == NULL);
+
+  bool found;
+  IdItem item = { 7, 0 };
+  assert(ahash_fixed_find_or_update(hash, item, &found)->value == 21 && found);
+  item.key = 501;
+  assert(ahash_fixed_find_or_update(hash, item, &found)->value == 0 && !found);
+
+  assert(ahash_fixed_delete(hash, 7));
+  assert(!ahash_fixed_delete(hash, 7));
+  assert(ahash_find(hash, 7) == NULL && ahash_fixed_find(hash, 8)->value == 24);
+}
+
+// Checks that the control bytes of a hash table agree with its slots.
+void check_ahash_control(void * hash)
+{
+  AHash * ahash = _ahash_header(hash);
+  const uint8_t * control = _ahash_control(ahash);
+  size_t slot_count = ahash->capacity * 2;
+  for (size_t i = 0; i < slot_count + 16; i++)
+  {
+    ArenaHashInt hv = ahash->table[i % slot_count].hash;
+    assert(control[i] == (hv ? _ahash_tag(hv) : 0));
+  }
+}
+
+void test_ahash_control_bytes()
+{
+  // Small tables have fewer slots than a group, so the copies of the
+  // control bytes wrap around more than once.
+  StringPair * hash = ahash_create(&arena, 1, AKEY_DEFAULT, StringPair);
+  ahash_update(hash, ((StringPair){ 5, 50 }));
+  check_ahash_control(hash);
+  assert(ahash_find(hash, 5)->value == 50);
+  assert(ahash_find(hash, 6) == NULL);
+  assert(ahash_delete(hash, 5));
+  check_ahash_control(hash);
+  assert(ahash_find(hash, 5) == NULL);
+
+  // Fill a table completely so probe sequences cross group boundaries and
+  // wrap around the end, then delete every other item.
+  const size_t count = 256;
+  for (size_t i = 0; i < count; i++)
+  {
+    ahash_update(hash, ((StringPair){ i * 64, i }));
+  }
+  assert(ahash_length(hash) == count);
+  check_ahash_control(hash);
+  for (size_t i = 0; i < count; i += 2) { assert(ahash_delete(hash, i * 64)); }
+  check_ahash_control(hash);
+  for (size_t i = 0; i < count; i++)
+  {
+    StringPair * p = ahash_find(hash, i * 64);
+    assert(i % 2 ? p && p->value == i : p == NULL);
+  }
+}
+
+void test_ahash_find_batch()
+{
+  // Look up a mix of present and missing keys, in more than one batch.
+  StringPair * hash = ahash_create(&arena, 0, AKEY_DEFAULT, StringPair);
+  for (size_t i = 0; i < 1000; i++)
+  {
+    ahash_update(hash, ((StringPair){ i * 2, i }));
+  }
+  size_t keys[AHASH_FIND_BATCH_SIZE * 3 + 5];
+  StringPair * results[sizeof(keys) / sizeof(keys[0])];
+  size_t count = sizeof(keys) / sizeof(keys[0]);
+  for (size_t i = 0; i < count; i++) { keys[i] = i * 37; }
+  ahash_find_batch(hash, keys, count, results);
+  for (size_t i = 0; i < count; i++)
+  {
+    assert(results[i] == ahash_find(hash, keys[i]));
+    assert(keys[i] % 2 ? results[i] == NULL : results[i]->value == keys[i] / 2);
+  }
+  ahash_find_batch(hash, keys, 0, results);
+
+  // String keys.
+  Intern * strings = ahash_create(&arena, 0, AKEY_STRING, Intern);
+  ahash_update(strings, ((Intern){ "apple" }));
+  ahash_update(strings, ((Intern){ "banana" }));
+  const char * names[3] = { "banana", "cherry", "apple" };
+  Intern * found[3];
+  ahash_find_batch(strings, names, 3, found);
+  assert(found[0] && !strcmp(found[0]->key, "banana"));
+  assert(found[1] == NULL);
+  assert(found[2] && !strcmp(found[2]->key, "apple"));
+}
+
+void test_ahash_str_n()
+{
+  typedef struct Token { const char * key; size_t count; } Token;
+  Token * tokens = ahash_create(&arena, 0, AKEY_STRING, Token);
+  const char * text = "the cat saw the other cat then";
+  const char * p = text;
+  while (*p)
+  {
+    size_t length = strcspn(p, " ");
+    bool found;
+    Token * token = ahash_find_or_update_str_n(tokens, p, length, &found);
+    assert(found == (token->count != 0));
+    assert(strlen(token->key) == length && !memcmp(token->key, p, length));
+    assert(token->key != p);
+    token->count++;
+    p += length;
+    if (*p) { p++; }
+  }
+  assert(ahash_length(tokens) == 5);
+  assert(ahash_find(tokens, "the")->count == 2);
+  assert(ahash_find(tokens, "cat")->count == 2);
+  assert(ahash_find_str_n(tokens, "catalog", 3) == ahash_find(tokens, "cat"));
+  assert(ahash_find_str_n(tokens, "then", 4)->count == 1);
+
+  // Prefixes, longer strings, and embedded nulls don't match.
+  assert(ahash_find_str_n(tokens, "th", 2) == NULL);
+  assert(ahash_find_str_n(tokens, "cats", 4) == NULL);
+  assert(ahash_find_str_n(tokens, "the\0x", 5) == NULL);
+  assert(ahash_find_str_n(tokens, "", 0) == NULL);
+}
+
+// Checks that the item hashes of a hash agree with its keys.
+void check_ahash_item_hashes(void * hash)
+{
+  AHash * ahash = _ahash_header(hash);
+  ArenaHashInt * item_hashes = _ahash_item_hashes(ahash);
+  for (size_t i = 0; i < ahash->length; i++)
+  {
+    const void * item = (const uint8_t *)hash + i * ahash->item_size;
+    assert(item_hashes[i] == _ahash_calculate_hash(hash, item));
+  }
+}
+
+void test_ahash_fast_delete()
+{
+  StringPair * hash = ahash_create(&arena, 4, AKEY_DEFAULT, StringPair);
+  for (size_t i = 0; i < 3; i++) { ahash_update(hash, ((StringPair){ i, i })); }
+  ahash_enable_fast_delete(hash);
+  ahash_enable_fast_delete(hash);
+  check_ahash_item_hashes(hash);
+
+  // Insert and evict items like a cache, growing the hash along the way.
+  bool present[300] = {};
+  for (size_t i = 0; i < 3; i++) { present[i] = true; }
+  for (size_t n = 0; n < 5000; n++)
+  {
+    size_t key = (n * 7919) % 300;
+    if (present[key]) { assert(ahash_delete(hash, key)); }
+    else { ahash_update(hash, ((StringPair){ key, key * 2 })); }
+    present[key] = !present[key];
+  }
+  check_ahash_item_hashes(hash);
+  check_ahash_control(hash);
+  for (size_t key = 0; key < 300; key++)
+  {
+    StringPair * p = ahash_find(hash, key);
+    assert(present[key] ? p && p->value == key * 2 : p == NULL);
+  }
+
+  // The item hashes survive copying and changing the hash function.
+  StringPair * copy = ahash_copy(hash, 1000);
+  check_ahash_item_hashes(copy);
+  ahash_set_hash_function(copy, ARENA_HASH_FAST);
+  check_ahash_item_hashes(copy);
+  while (ahash_length(copy)) { assert(ahash_delete(copy, copy[0].key)); }
+
+  // String keys.
+  Intern * strings = ahash_create(&arena, 0, AKEY_STRING, Intern);
+  ahash_enable_fast_delete(strings);
+  const char * words[] = { "alpha", "beta", "gamma", "delta" };
+  for (size_t i = 0; i < 4; i++) { ahash_update(strings, ((Intern){ words[i] })); }
+  assert(ahash_delete(strings, "alpha"));
+  assert(strings[0].key == words[3]);
+  check_ahash_item_hashes(strings);
+  for (size_t i = 1; i < 4; i++) { assert(ahash_find(strings, words[i])->key == words[i]); }
+}
+
+void test_ahash_incremental_growth()
+{
+  StringPair * hash = ahash_create(&arena, 0, AKEY_DEFAULT, StringPair);
+  ahash_enable_incremental_growth(hash);
+  bool present[2000] = {};
+  bool saw_old_table = false;
+  for (size_t n = 0; n < 6000; n++)
+  {
+    // Mostly add items, but also delete some and update some while the
+    // hash is growing, so we hit both tables.
+    size_t key = (n * 7919) % 2000;
+    if (present[key] && n % 3 == 0)
+    {
+      assert(ahash_delete(hash, key));
+      present[key] = false;
+    }
+    else
+    {
+      bool found;
+      StringPair * p = ahash_find_or_update(hash, ((StringPair){ key, key + 1 }), &found);
+      assert(found == present[key] && p->key == key && p->value == key + 1);
+      present[key] = true;
+    }
+    AHash * ahash = _ahash_header(hash);
+    if (ahash->old_table)
+    {
+      saw_old_table = true;
+      assert(ahash->old_capacity * 2 == ahash->capacity);
+    }
+    if (n % 97 == 0)
+    {
+      check_ahash_control(hash);
+      for (size_t k = 0; k < 2000; k++)
+      {
+        StringPair * p = ahash_find(hash, k);
+        assert(present[k] ? p && p->value == k + 1 : p == NULL);
+      }
+    }
+  }
+  assert(saw_old_table);
+
+  // Make a hash that is in the middle of growing.
+  StringPair * growing = ahash_create(&arena, 64, AKEY_DEFAULT, StringPair);
+  ahash_enable_incremental_growth(growing);
+  for (size_t i = 0; i < 65; i++) { ahash_update(growing, ((StringPair){ i, i })); }
+  assert(_ahash_header(growing)->old_table);
+
+  // Copying it moves everything to one table.
+  StringPair * copy = ahash_copy(growing, 0);
+  assert(_ahash_header(copy)->old_table == NULL);
+  for (size_t i = 0; i < 65; i++) { assert(ahash_find(copy, i)->value == i); }
+
+  // So does enabling fast deletion, or changing the hash function.
+  ahash_enable_fast_delete(growing);
+  assert(_ahash_header(growing)->old_table == NULL);
+  check_ahash_item_hashes(growing);
+  for (size_t i = 65; i < 130; i++) { ahash_update(growing, ((StringPair){ i, i })); }
+  assert(_ahash_header(growing)->old_table);
+  for (size_t i = 0; i < 130; i += 2) { assert(ahash_delete(growing, i)); }
+  check_ahash_item_hashes(growing);
+  ahash_set_hash_function(growing, ARENA_HASH_FAST);
+  assert(_ahash_header(growing)->old_table == NULL);
+  check_ahash_control(growing);
+  for (size_t i = 0; i < 130; i++)
+  {
+    StringPair * p = ahash_find(growing, i);
+    assert(i % 2 ? p && p->value == i : p == NULL);
+  }
+}
+
+void test_ahash_hash_functions()
+{
+  // The fast hash handles every length and spreads out similar inputs.
+  uint8_t data[100];
+  for (size_t i = 0; i < sizeof(data); i++) { data[i] = (uint8_t)i; }
+  ArenaHashInt previous = 0;
+  for (size_t length = 0; length <= sizeof(data); length++)
+  {
+    ArenaHashInt h = arena_hash_using(&arena, ARENA_HASH_FAST, data, length);
+    assert(h != 0 && h != previous);
+    assert(h == arena_hash_using(&arena, ARENA_HASH_FAST, data, length));
+    previous = h;
+  }
+
+  // Keys that only differ in their top 16 bits still land in different slots.
+  bool used[4096] = {};
+  size_t distinct = 0;
+  for (uint64_t i = 0; i < 1024; i++)
+  {
+    uint64_t key = i << 48;
+    ArenaHashInt h = arena_hash_using(&arena, ARENA_HASH_FAST, (uint8_t *)&key, 8);
+    if (!used[h % 4096]) { used[h % 4096] = true; distinct++; }
+  }
+  assert(distinct > 800);
+
+  Arena farena = {};
+  farena.hash_function = ARENA_HASH_FAST;
+  Intern * strings = ahash_create(&farena, 0, AKEY_STRING, Intern);
+  StringPair * ids = ahash_create(&farena, 0, AKEY_DEFAULT, StringPair);
+  assert(_ahash_header(strings)->hash_function == ARENA_HASH_FAST);
+  char names[200][8];
+  for (size_t i = 0; i < 200; i++)
+  {
+    snprintf(names[i], sizeof(names[i]), "n%zu", i);
+    Intern intern = { names[i] };
+    ahash_update(strings, intern);
+    ahash_update(ids, ((StringPair){ i, i + 1 }));
+  }
+  for (size_t i = 0; i < 200; i++)
+  {
+    char name[8];
+    snprintf(name, sizeof(name), "n%zu", i);
+    assert(ahash_find(strings, name)->key == names[i]);
+    assert(ahash_fixed_find(ids, i)->value == i + 1);
+  }
+  StringPair * shifted = ahash_create(&farena, 0, AKEY_DEFAULT, StringPair);
+  for (size_t i = 0; i < 20000; i++)
+  {
+    ahash_update(shifted, ((StringPair){ (size_t)i << 48, i }));
+  }
+  for (size_t i = 0; i < 20000; i++)
+  {
+    assert(ahash_find(shifted, (size_t)i << 48)->value == i);
+  }
+
+  // Switching the hash function rebuilds the table.
+  ahash_set_hash_function(ids, ARENA_HASH_SIPHASH);
+  for (size_t i = 0; i < 200; i++) { assert(ahash_find(ids, i)->value == i + 1); }
+  assert(ahash_find(ids, 200) == NULL);
+  arena_free(&farena);
+}
+
 int main()
 {
   srand(time(NULL));
@@ -645,6 +1695,25 @@ int main()
   test_vsnprintf();
 
   test_arena_randomly();
+  test_arena_concurrent();
+#ifdef __cplusplus
+  test_arena_concurrent_threads();
+#endif
+  test_arena_virtual();
+  test_arena_block_allocators();
+  test_arena_rewind();
+  test_arena_large_allocation();
+  test_arena_tails();
+  test_arena_stats();
+  test_arena_decay();
+  test_arena_trim_unknown_memory();
+  test_arena_zero_tracking();
+  test_arena_alloc_array();
+  test_arena_realloc();
+  test_arena_scratch();
+  test_arena_defer();
+  test_arena_cpp_allocators();
+  test_arena_cpp_wrappers();
 
   test_arena_printf();
 
@@ -659,6 +1728,14 @@ int main()
   test_ahash_type_string();
   test_ahash_type_byte_slice();
   test_ahash_growth();
+  test_ahash_delete_many();
+  test_ahash_fixed();
+  test_ahash_hash_functions();
+  test_ahash_control_bytes();
+  test_ahash_find_batch();
+  test_ahash_str_n();
+  test_ahash_fast_delete();
+  test_ahash_incremental_growth();
 
   printf("Success.\n");
 
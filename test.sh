@@ -9,3 +9,7 @@ set -x
 gcc $FLAGS arena_test.c -o arena_test_c && ./arena_test_c || echo 'C fail'
 
 g++ $FLAGS arena_test.c -o arena_test_cpp && ./arena_test_cpp || echo 'C++ fail'
+
+gcc $FLAGS -DARENA_STATS=1 arena_test.c -o arena_test_stats_c && ./arena_test_stats_c || echo 'C stats fail'
+
+g++ $FLAGS -DARENA_STATS=1 arena_test.c -o arena_test_stats_cpp && ./arena_test_stats_cpp || echo 'C++ stats fail'